@@ -19,6 +19,11 @@
 #define RANDOM_SEED 836939
 #endif
 
+//destructive interference size, 128 suits cpus that prefetch lines in pairs
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
 #ifndef DEBUG_STREAM
 #define DEBUG_STREAM stdout
 #endif
@@ -35,10 +40,13 @@
 
 //container-deps
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <list>
+#include <deque>
 #include <tuple>
 #include <queue>
+#include <iterator>
 
 //io deps
 #include <iostream>
@@ -51,59 +59,857 @@
 #include <sstream>
 #include <utility>
 #include <memory>
+#include <cstdint>
+#include <climits>
+#include <future>
+#include <functional>
+#include <limits>
+#include <system_error>
+#include <stdexcept>
 
 //color coding under windows deps
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
+//futex deps
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <ctime>
+//declared by hand so that unistd.h doesn't put POSIX names like alarm or close into every includer's namespace
+#ifdef __GLIBC__
+extern "C" long int syscall(long int sysno, ...) noexcept;
+#else
+#include <unistd.h>
+#endif
+#endif
+
+//thread placement deps
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <climits>
+#endif
+
+//fiber deps
+#ifdef __linux__
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/auxv.h>
+#endif
+
+//inter-process mailbox deps, opt in with CDPL_IPC as they bring POSIX names along
+#if defined(__linux__) && defined(CDPL_IPC)
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
 template <typename... Args>
 inline void DEBUG_WRITE(const char* name, const char* format, Args&&... args);
 inline void DEBUG_WRITE(const char* name, const char* format);
 
 namespace Concurrent {
+	namespace impl {
+		/**
+		 * Blocks while *addr holds expected value. Returns after wake, on value change or spuriously,
+		 * so callers always recheck their condition in a loop.
+		 */
+		inline void futex_wait(std::atomic<int>* addr, int expected);
+		/**
+		 * Wakes up to count threads blocked in futex_wait on addr
+		 */
+		inline void futex_wake(std::atomic<int>* addr, int count);
+
+		/**
+		 * Same as futex_wait, but gives up when deadline passes
+		 * @return bool false if woken up due to timeout
+		 */
+		inline bool futex_wait_until(std::atomic<int>* addr, int expected, const std::chrono::steady_clock::time_point& deadline);
+
+		typedef std::chrono::steady_clock::time_point deadline_t;
+		//converts time point of any clock to steady clock deadline
+		template <class Clock, class Duration>
+		deadline_t to_deadline(const std::chrono::time_point<Clock, Duration>& abs_time) {
+			return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(abs_time - Clock::now());
+		}
+		inline deadline_t to_deadline(const deadline_t& abs_time) {
+			return abs_time;
+		}
+
+#ifdef __linux__
+		struct fiber_t;
+		/**
+		 * Fiber running on calling thread, null outside of fibers. Fibers move between
+		 * threads, so the thread local must be looked up anew on every call.
+		 */
+		__attribute__((noinline)) inline fiber_t*& current_fiber() {
+			static thread_local fiber_t* fiber = nullptr;
+			asm volatile(""); //keeps compiler from merging calls
+			return fiber;
+		}
+		//park and wake fibers instead of threads, defined together with FiberScheduler
+		inline bool fiber_wait(std::atomic<int>* addr, int expected, const deadline_t* deadline);
+		inline void fiber_wake(std::atomic<int>* addr, int count);
+		inline std::size_t fiber_index(const fiber_t* fiber);
+
+		inline void futex_wait(std::atomic<int>* addr, int expected) {
+			if (current_fiber()) {
+				fiber_wait(addr, expected, nullptr);
+				return;
+			}
+			syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+		}
+		inline bool futex_wait_until(std::atomic<int>* addr, int expected, const deadline_t& deadline) {
+			if (current_fiber())
+				return fiber_wait(addr, expected, &deadline);
+			auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (remaining <= 0)
+				return false;
+			timespec timeout{ static_cast<time_t>(remaining / 1000000000), static_cast<long>(remaining % 1000000000) };
+			return !(syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAIT_PRIVATE, expected, &timeout, nullptr, 0) != 0 && errno == ETIMEDOUT);
+		}
+		inline void futex_wake(std::atomic<int>* addr, int count) {
+			syscall(SYS_futex, reinterpret_cast<int*>(addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+			fiber_wake(addr, count);
+		}
+#else
+		//emulation through a small table of condition variables hashed by address
+		struct parking_bucket_t {
+			std::mutex mutex;
+			std::condition_variable cond;
+		};
+		inline parking_bucket_t& parking_bucket(const void* addr) {
+			static parking_bucket_t buckets[64];
+			return buckets[(reinterpret_cast<std::uintptr_t>(addr) >> 4) % 64];
+		}
+		inline void futex_wait(std::atomic<int>* addr, int expected) {
+			parking_bucket_t& bucket = parking_bucket(addr);
+			std::unique_lock<std::mutex> lock(bucket.mutex);
+			if (addr->load() == expected)
+				bucket.cond.wait(lock);
+		}
+		inline bool futex_wait_until(std::atomic<int>* addr, int expected, const deadline_t& deadline) {
+			parking_bucket_t& bucket = parking_bucket(addr);
+			std::unique_lock<std::mutex> lock(bucket.mutex);
+			return addr->load() != expected || bucket.cond.wait_until(lock, deadline) == std::cv_status::no_timeout;
+		}
+		inline void futex_wake(std::atomic<int>* addr, int count) {
+			parking_bucket_t& bucket = parking_bucket(addr);
+			std::unique_lock<std::mutex> lock(bucket.mutex);
+			bucket.cond.notify_all();
+		}
+#endif
+
+		inline std::atomic<std::size_t>& slot_counter() {
+			static std::atomic<std::size_t> next_index{ 0 };
+			return next_index;
+		}
+		/**
+		 * Small number that stays the same for calling thread, or for running fiber,
+		 * used to pick per-thread slots
+		 */
+		inline std::size_t slot_index() {
+#ifdef __linux__
+			if (const fiber_t* fiber = current_fiber())
+				return fiber_index(fiber);
+#endif
+			static thread_local const std::size_t index = slot_counter()++;
+			return index;
+		}
+	}
+
+	/**
+	 * Bytes apart two objects must be so that writing one doesn't invalidate the other
+	 * in other cores' caches (std::hardware_destructive_interference_size is C++17)
+	 */
+	constexpr std::size_t cache_line_size = CACHE_LINE_SIZE;
+
+	/**
+	 * Keeps value on cache lines of its own, for arrays or neighbouring members
+	 * that different threads write to, e.g. CachePadded<sem_t> forks[N].
+	 * Value is padded to a whole number of lines rather than aligned, as new ignores
+	 * extended alignment before C++17 and CachePadded objects often live on the heap.
+	 * Whatever is declared right before a CachePadded member may share its first line.
+	 */
+	template <class T>
+	struct CachePadded {
+		T value;
+		char padding[cache_line_size - sizeof(T) % cache_line_size];
+
+		template <typename... Args>
+		CachePadded(Args&&... args) :value(std::forward<Args>(args)...) {}
+		T& operator*() { return value; }
+		const T& operator*() const { return value; }
+		T* operator->() { return &value; }
+		const T* operator->() const { return &value; }
+	};
+
+	namespace impl {
+		//shards per sharded object, enough to give each hardware thread its own
+		inline std::size_t shard_count() {
+			static const std::size_t count = [] {
+				std::size_t count = 1;
+				while (count < std::thread::hardware_concurrency() && count < 64)
+					count *= 2;
+				return count;
+			}();
+			return count;
+		}
+		//number of bits needed to represent value, 0 for 0
+		inline int bit_width(std::uint64_t value) {
+#if defined(__GNUC__)
+			return value ? 64 - __builtin_clzll(value) : 0;
+#else
+			int width = 0;
+			for (; value; value >>= 1)
+				width++;
+			return width;
+#endif
+		}
+	}
+
+	/**
+	 * Counter that threads add to without contending, each on its own padded shard.
+	 * Reading sums the shards, so it costs more than adding, and concurrent adds
+	 * may or may not be included in it.
+	 */
+	class ShardedCounter {
+		std::vector<CachePadded<std::atomic<std::int64_t>>> shards = std::vector<CachePadded<std::atomic<std::int64_t>>>(impl::shard_count());
+	public:
+		ShardedCounter() = default;
+		ShardedCounter(const ShardedCounter&) = delete;
+		ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+		void add(std::int64_t n) {
+			shards[impl::slot_index() % shards.size()]->fetch_add(n, std::memory_order_relaxed);
+		}
+		ShardedCounter& operator++() {
+			add(1);
+			return *this;
+		}
+		ShardedCounter& operator--() {
+			add(-1);
+			return *this;
+		}
+		ShardedCounter& operator+=(std::int64_t n) {
+			add(n);
+			return *this;
+		}
+		std::int64_t value() const {
+			std::int64_t sum = 0;
+			for (auto& shard : shards)
+				sum += shard->load(std::memory_order_relaxed);
+			return sum;
+		}
+		operator std::int64_t() const {
+			return value();
+		}
+		void reset() {
+			for (auto& shard : shards)
+				shard->store(0, std::memory_order_relaxed);
+		}
+	};
+
+	/**
+	 * Distribution of non-negative values, e.g. latencies in nanoseconds, sharded like ShardedCounter.
+	 * Bucket b counts values with bit width b, i.e. from 2^(b-1) up to 2^b - 1, bucket 0 counts zeros.
+	 */
+	class ShardedHistogram {
+	public:
+		static constexpr int bucket_count = 65;
+
+		struct snapshot_t {
+			std::uint64_t count = 0;
+			std::uint64_t sum = 0;
+			std::uint64_t max = 0;
+			std::uint64_t buckets[bucket_count] = {};
+
+			double mean() const {
+				return count ? static_cast<double>(sum) / count : 0;
+			}
+			/**
+			 * @param double q Quantile from 0 to 1, e.g. 0.99
+			 * @return std::uint64_t Upper bound of bucket the quantile falls in, never above max
+			 */
+			std::uint64_t percentile(double q) const {
+				const std::uint64_t rank = static_cast<std::uint64_t>(q * count);
+				std::uint64_t seen = 0;
+				for (int b = 0; b < bucket_count; b++) {
+					seen += buckets[b];
+					if (seen > rank || (seen == count && seen))
+						return std::min(max, b == 0 ? 0 : b == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << b) - 1);
+				}
+				return max;
+			}
+		};
+	private:
+		struct shard_t {
+			std::atomic<std::uint64_t> sum;
+			std::atomic<std::uint64_t> max;
+			std::atomic<std::uint64_t> buckets[bucket_count];
+
+			shard_t() {
+				reset();
+			}
+			void reset() {
+				sum.store(0, std::memory_order_relaxed);
+				max.store(0, std::memory_order_relaxed);
+				for (auto& bucket : buckets)
+					bucket.store(0, std::memory_order_relaxed);
+			}
+		};
+		std::vector<CachePadded<shard_t>> shards = std::vector<CachePadded<shard_t>>(impl::shard_count());
+	public:
+		ShardedHistogram() = default;
+		ShardedHistogram(const ShardedHistogram&) = delete;
+		ShardedHistogram& operator=(const ShardedHistogram&) = delete;
+
+		void record(std::uint64_t value) {
+			shard_t& shard = *shards[impl::slot_index() % shards.size()];
+			shard.buckets[impl::bit_width(value)].fetch_add(1, std::memory_order_relaxed);
+			shard.sum.fetch_add(value, std::memory_order_relaxed);
+			for (std::uint64_t max = shard.max.load(std::memory_order_relaxed); value > max && !shard.max.compare_exchange_weak(max, value, std::memory_order_relaxed););
+		}
+		template <class Rep, class Period>
+		void record(const std::chrono::duration<Rep, Period>& duration) {
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+			record(static_cast<std::uint64_t>(ns < 0 ? 0 : ns));
+		}
+		/**
+		 * Sums the shards, values recorded meanwhile may or may not be included
+		 */
+		snapshot_t snapshot() const {
+			snapshot_t total;
+			for (auto& shard : shards) {
+				total.sum += shard->sum.load(std::memory_order_relaxed);
+				total.max = std::max(total.max, shard->max.load(std::memory_order_relaxed));
+				for (int b = 0; b < bucket_count; b++) {
+					const std::uint64_t n = shard->buckets[b].load(std::memory_order_relaxed);
+					total.buckets[b] += n;
+					total.count += n;
+				}
+			}
+			return total;
+		}
+		void reset() {
+			for (auto& shard : shards)
+				shard->reset();
+		}
+	};
+
+#ifdef CHECK_DEADLOCK
+	namespace impl {
+		/**
+		 * Lock order checker, compiled in with CHECK_DEADLOCK. Each thread keeps the locks it holds
+		 * and blocking acquisition of another one adds held -> acquired edges to a global graph.
+		 * Edge that closes a cycle is reported as possible deadlock, even if the threads never met.
+		 * A thread takes the graph lock only for edges it hasn't taken before, so steady state
+		 * costs a few thread local operations per lock. Semaphore counts as held until the thread
+		 * that took it signals it, one signalled by other threads serves for signalling and is
+		 * left out of the order. Shared locking and locks taken inside fibers aren't tracked.
+		 */
+		struct lock_checker_t {
+			static constexpr int max_held = 32;
+
+			struct held_t {
+				std::atomic<const void*> lock{ nullptr };
+				std::atomic<const char*> kind{ "" };
+			};
+			struct edge_hash_t {
+				std::size_t operator()(const std::pair<const void*, const void*>& edge) const {
+					return std::hash<const void*>()(edge.first) * 31 + std::hash<const void*>()(edge.second);
+				}
+			};
+			/**
+			 * Locks held and wait in progress of one thread, published for the watchdog.
+			 * Entries are taken over by new threads and never freed, so reading them needs no lock.
+			 */
+			struct thread_state_t {
+				held_t held[max_held];
+				std::atomic<int> depth{ 0 };
+				std::atomic<const void*> blocked_on{ nullptr };
+				std::atomic<const char*> blocked_kind{ "" };
+				std::atomic<const char*> blocked_name{ "" };
+				std::atomic<int> blocked_rank{ -1 };
+				std::atomic<std::chrono::steady_clock::rep> blocked_since{ 0 };
+				std::atomic<int> id{ -1 };
+				std::atomic<const char*> name{ "" };
+				std::atomic<bool> in_use{ false };
+				thread_state_t* next = nullptr; //immutable once in list
+				//used only by the owning thread
+				bool busy = false;       //inside the checker, locks taken meanwhile aren't tracked
+				int overflow = 0;        //acquisitions that didn't fit in held
+				std::uint64_t epoch = 0; //graph epoch the caches below are valid for
+				std::unordered_set<std::pair<const void*, const void*>, edge_hash_t> edges; //already in graph
+				std::unordered_set<const void*> signalling; //semaphores known to serve for signalling
+			};
+			struct edge_t {
+				const void* to;
+				int thread_id; //thread that took the edge first
+				std::string thread_name;
+			};
+			struct node_t {
+				const char* kind = "";
+				bool signalling = false;
+				std::vector<edge_t> edges;
+			};
+			struct graph_t {
+				std::mutex mutex;
+				std::unordered_map<const void*, node_t> nodes;
+				std::atomic<std::uint64_t> epoch{ 0 }; //bumped when a lock is forgotten
+				std::atomic<std::uint64_t> known[64] = {}; //address filter of nodes, lets destroyed skip the lock
+			};
+			/**
+			 * Marks calling thread as blocked for the duration of scope
+			 */
+			struct wait_t {
+				thread_state_t* state;
+				wait_t(const void* on, const char* kind, const char* name = "", int rank = -1);
+				~wait_t();
+			};
+
+			static graph_t& graph();
+			static std::atomic<thread_state_t*>& registry();
+			static thread_state_t* state();
+
+			//blocking acquisition of lock is about to start, checks its order against held locks
+			static void acquiring(const void* lock, const char* kind);
+			static void acquired(const void* lock, const char* kind);
+			static void released(const void* lock);
+			//semaphore signalled, which releases it or marks it as used for signalling
+			static void signalled(const void* lock);
+			static void destroyed(const void* lock);
+			/**
+			 * Writes every blocked thread with locks it holds and cycles of threads waiting for each other
+			 */
+			static void dump();
+
+			static void refresh(thread_state_t* state);
+			static bool remove(thread_state_t* state, const void* lock);
+			static std::atomic<std::uint64_t>& known_bit(graph_t& graph, const void* lock, std::uint64_t& mask);
+			static void add_edge(thread_state_t* state, const void* from, const char* from_kind, const void* to, const char* to_kind);
+			static bool find_path(graph_t& graph, const void* from, const void* to, std::unordered_set<const void*>& visited, std::vector<std::pair<const void*, const edge_t*>>& path);
+		};
+		constexpr int lock_checker_t::max_held;
+	}
+#endif
+
+	/**
+	 * Counting semaphore that takes and returns permits with a single atomic operation
+	 * while they are available, and blocks on futex only when it has to wait.
+	 */
 	class Semaphore {
-		std::mutex mutex;
-		std::condition_variable cond;
-		int val;
+		std::atomic<int> val;         //available permits, never negative
+		std::atomic<int> waiters{ 0 }; //threads that are or are about to be blocked on val
+
+		inline bool try_acquire() {
+			int current = val.load();
+			while (current > 0)
+				if (val.compare_exchange_weak(current, current - 1))
+					return true;
+			return false;
+		}
 	public:
 		Semaphore(int val = 0) : val(val) {}
+#ifdef CHECK_DEADLOCK
+		~Semaphore() {
+			impl::lock_checker_t::destroyed(this);
+		}
+#endif
 		/**
 		 * Increments the internal value of semaphore by 1.
-		 * If the pre-increment value was negative (there are processes waiting for resource),
-		 * it transfers a blocked process from the semaphore's waiting queue to the ready queue
+		 * If there are processes waiting for resource, it transfers one of them
+		 * from the semaphore's waiting queue to the ready queue
 		 */
 		inline void signal() {
-			std::unique_lock<std::mutex> lock(mutex);
-			if (val++ < 0)
-				cond.notify_one();
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::signalled(this);
+#endif
+			val.fetch_add(1);
+			if (waiters.load() > 0)
+				impl::futex_wake(&val, 1);
 		}
 		/**
-		 * Decrements the internal value of semaphore by 1. After the decrement,
-		 * if the post-decrement value was negative, the process executing wait is blocked
-		 * (added to the semaphore's queue). Otherwise, the process continues execution.
+		 * Decrements the internal value of semaphore by 1 if it is positive.
+		 * Otherwise the process executing wait is blocked (added to the semaphore's queue)
+		 * until the value becomes positive.
 		 */
 		inline void wait() {
-			std::unique_lock<std::mutex> lock(mutex);
-			if (--val < 0)
-				cond.wait(lock);
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::acquiring(this, "semaphore");
+#endif
+			if (!try_acquire()) {
+#ifdef CHECK_DEADLOCK
+				impl::lock_checker_t::wait_t blocked(this, "semaphore");
+#endif
+				waiters.fetch_add(1);
+				while (!try_acquire())
+					impl::futex_wait(&val, 0);
+				waiters.fetch_sub(1);
+			}
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::acquired(this, "semaphore");
+#endif
+		}
+		/**
+		 * Decrements the internal value of semaphore if it is positive, never blocks.
+		 * @return bool Whether the value was decremented
+		 */
+		inline bool try_wait() {
+			if (!try_acquire())
+				return false;
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::acquired(this, "semaphore");
+#endif
+			return true;
+		}
+		/**
+		 * Same as wait, but gives up once abs_time is reached.
+		 * @return bool Whether the value was decremented
+		 */
+		template <class Clock, class Duration>
+		bool wait_until(const std::chrono::time_point<Clock, Duration>& abs_time) {
+			if (try_wait())
+				return true;
+			const impl::deadline_t deadline = impl::to_deadline(abs_time);
+			bool acquired;
+			{
+#ifdef CHECK_DEADLOCK
+				impl::lock_checker_t::wait_t blocked(this, "semaphore");
+#endif
+				waiters.fetch_add(1);
+				while (!(acquired = try_acquire()) && impl::futex_wait_until(&val, 0, deadline));
+				if (!acquired)
+					acquired = try_acquire(); //permit might have arrived together with timeout
+				waiters.fetch_sub(1);
+			}
+#ifdef CHECK_DEADLOCK
+			if (acquired)
+				impl::lock_checker_t::acquired(this, "semaphore");
+#endif
+			return acquired;
+		}
+		/**
+		 * Same as wait, but gives up after rel_time passes.
+		 * @return bool Whether the value was decremented
+		 */
+		template <class Rep, class Period>
+		bool wait_for(const std::chrono::duration<Rep, Period>& rel_time) {
+			return wait_until(std::chrono::steady_clock::now() + rel_time);
 		}
 	};
 	typedef Semaphore sem_t;
 
+	namespace impl {
+		/**
+		 * Hints the processor that caller is spinning
+		 */
+		inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+			asm volatile("yield");
+#elif defined(_WIN32)
+			YieldProcessor();
+#else
+			std::this_thread::yield();
+#endif
+		}
+		//spinning only pays off when lock holder can run at the same time
+		inline bool spinning_allowed() {
+			static const bool allowed = std::thread::hardware_concurrency() > 1;
+			return allowed;
+		}
+	}
+
 	/**
-	 * Eqiuivalent of semaphore with initial value 1, where lock and unlock methods
-	 * are aliases for signal and wait operation.
+	 * Eqiuivalent of semaphore with initial value 1, where lock and unlock are signal and wait
+	 * operation. Contended lock spins for a while with exponential backoff before parking the thread,
+	 * the number of spin rounds adapts to how often spinning succeeded recently.
+	 * Fair mutex hands the lock over to waiters in FIFO order instead of letting newcomers barge in.
 	 */
 	class Mutex {
-		sem_t sem;
+		static constexpr int max_spin_rounds = 16;
+		static constexpr int max_backoff = 64;
+
+		std::atomic<int> state{ 0 }; //0 - unlocked, 1 - locked, 2 - locked and there might be parked waiters
+		std::atomic<int> spin_rounds{ max_spin_rounds / 2 };
+		//fair mode uses ticket lock, thread holding ticket equal to serving owns the mutex
+		std::atomic<int> next_ticket{ 0 };
+		std::atomic<int> serving{ 0 };
+		std::atomic<int> parked{ 0 };
+		const bool fair;
+
+		//spins with backoff while try_acquire fails, adjusts spin budget according to the outcome
+		template <typename F>
+		bool spin(F try_acquire) {
+			if (!impl::spinning_allowed())
+				return false;
+			const int rounds = spin_rounds.load(std::memory_order_relaxed);
+			for (int round = 0, backoff = 1; round < rounds; round++, backoff = std::min(backoff * 2, max_backoff)) {
+				for (int i = 0; i < backoff; i++)
+					impl::cpu_relax();
+				if (try_acquire()) {
+					spin_rounds.store(std::min(max_spin_rounds, rounds + 1), std::memory_order_relaxed);
+					return true;
+				}
+			}
+			spin_rounds.store(std::max(1, rounds - 1), std::memory_order_relaxed);
+			return false;
+		}
+		void lock_slow() {
+			int c = 0;
+			if (spin([this, &c] { c = 0; return state.load(std::memory_order_relaxed) == 0 && state.compare_exchange_strong(c, 1, std::memory_order_acquire); }))
+				return;
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::wait_t blocked(this, "mutex");
+#endif
+			c = state.exchange(2, std::memory_order_acquire);
+			while (c != 0) {
+				impl::futex_wait(&state, 2);
+				c = state.exchange(2, std::memory_order_acquire);
+			}
+		}
+		void lock_fair() {
+			const int ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+			if (serving.load(std::memory_order_acquire) == ticket)
+				return;
+			//only the next in line spins, others would just burn cycles
+			if (ticket - serving.load(std::memory_order_relaxed) == 1 && spin([this, ticket] { return serving.load(std::memory_order_acquire) == ticket; }))
+				return;
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::wait_t blocked(this, "mutex");
+#endif
+			parked.fetch_add(1);
+			int current;
+			while ((current = serving.load()) != ticket)
+				impl::futex_wait(&serving, current);
+			parked.fetch_sub(1);
+		}
+		bool lock_slow_until(const impl::deadline_t& deadline) {
+			int c = 0;
+			if (spin([this, &c] { c = 0; return state.load(std::memory_order_relaxed) == 0 && state.compare_exchange_strong(c, 1, std::memory_order_acquire); }))
+				return true;
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::wait_t blocked(this, "mutex");
+#endif
+			c = state.exchange(2, std::memory_order_acquire);
+			while (c != 0) {
+				if (!impl::futex_wait_until(&state, 2, deadline) && std::chrono::steady_clock::now() >= deadline)
+					return false;
+				c = state.exchange(2, std::memory_order_acquire);
+			}
+			return true;
+		}
+		//taken ticket can't be given back, so timed fair lock only grabs the mutex when nobody is queued
+		bool lock_fair_until(const impl::deadline_t& deadline) {
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::wait_t blocked(this, "mutex");
+#endif
+			while (!try_acquire()) {
+				int current = serving.load();
+				parked.fetch_add(1);
+				bool woken = next_ticket.load() == current || impl::futex_wait_until(&serving, current, deadline);
+				parked.fetch_sub(1);
+				if (!woken && std::chrono::steady_clock::now() >= deadline)
+					return try_acquire();
+			}
+			return true;
+		}
+		inline bool try_acquire() {
+			if (fair) {
+				int ticket = serving.load(std::memory_order_acquire);
+				int expected = ticket;
+				return next_ticket.compare_exchange_strong(expected, ticket + 1, std::memory_order_acquire);
+			}
+			int c = 0;
+			return state.compare_exchange_strong(c, 1, std::memory_order_acquire);
+		}
 	public:
-		Mutex() :sem(1) {}
-		inline void lock() { sem.wait(); }
-		inline void unlock() { sem.signal(); }
+		Mutex(bool fair = false) : fair(fair) {}
+#ifdef CHECK_DEADLOCK
+		~Mutex() {
+			impl::lock_checker_t::destroyed(this);
+		}
+#endif
+		/**
+		 * Acquires mutex only if it is free at the moment, never blocks.
+		 * @return bool Whether mutex was acquired
+		 */
+		inline bool try_lock() {
+			if (!try_acquire())
+				return false;
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::acquired(this, "mutex");
+#endif
+			return true;
+		}
+		/**
+		 * Same as lock, but gives up once abs_time is reached.
+		 * @return bool Whether mutex was acquired
+		 */
+		template <class Clock, class Duration>
+		bool try_lock_until(const std::chrono::time_point<Clock, Duration>& abs_time) {
+			if (try_acquire() || (fair ? lock_fair_until(impl::to_deadline(abs_time)) : lock_slow_until(impl::to_deadline(abs_time)))) {
+#ifdef CHECK_DEADLOCK
+				impl::lock_checker_t::acquired(this, "mutex");
+#endif
+				return true;
+			}
+			return false;
+		}
+		/**
+		 * Same as lock, but gives up after rel_time passes.
+		 * @return bool Whether mutex was acquired
+		 */
+		template <class Rep, class Period>
+		bool try_lock_for(const std::chrono::duration<Rep, Period>& rel_time) {
+			return try_lock_until(std::chrono::steady_clock::now() + rel_time);
+		}
+		inline void lock() {
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::acquiring(this, "mutex");
+#endif
+			int c = 0;
+			if (fair)
+				lock_fair();
+			else if (!state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+				lock_slow();
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::acquired(this, "mutex");
+#endif
+		}
+		inline void unlock() {
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::released(this);
+#endif
+			if (fair) {
+				serving.fetch_add(1);
+				if (parked.load() > 0)
+					impl::futex_wake(&serving, INT_MAX); //waiters can't be woken selectively, the one holding the ticket proceeds
+			}
+			else if (state.exchange(0, std::memory_order_release) == 2)
+				impl::futex_wake(&state, 1);
+		}
 	};
+	constexpr int Mutex::max_spin_rounds;
+	constexpr int Mutex::max_backoff;
 
 	typedef Mutex mutex_t;
+
+	/**
+	 * Readers-writer lock for read mostly data. Readers announce themselves in one of
+	 * several padded per-thread slots instead of a single shared counter, so shared
+	 * locking from different cores doesn't bounce the same cache line. Writer raises
+	 * the flag and waits for all slots to drain, readers step aside while the flag is up.
+	 */
+	class SharedMutex {
+		static constexpr std::size_t max_slots = 64;
+		typedef CachePadded<std::atomic<int>> slot_t; //readers in the slot
+
+		std::unique_ptr<slot_t[]> slots{ new slot_t[slot_count()] };
+		std::atomic<int> writer{ 0 }; //0 - no writer, 1 - writer active or pending, 2 - also readers parked on it
+		Mutex writers; //serializes writers among themselves
+
+		//number of slots in use, enough to give each hardware thread its own
+		static std::size_t slot_count() {
+			static const std::size_t count = [] {
+				std::size_t count = 1;
+				while (count < std::thread::hardware_concurrency() && count < max_slots)
+					count *= 2;
+				return count;
+			}();
+			return count;
+		}
+		std::atomic<int>& my_slot() {
+			return *slots[impl::slot_index() % slot_count()];
+		}
+		//leaves the slot and lets waiting writer know when it was the last one there
+		void leave(std::atomic<int>& readers) {
+			if (readers.fetch_sub(1) == 1 && writer.load() != 0)
+				impl::futex_wake(&readers, 1);
+		}
+		void wait_for_writer() {
+			int w = writer.load();
+			while (w != 0) {
+				if (w == 1 && !writer.compare_exchange_weak(w, 2))
+					continue;
+				impl::futex_wait(&writer, 2);
+				w = writer.load();
+			}
+		}
+		void drain_readers() {
+			for (std::size_t i = 0; i < slot_count(); i++)
+				for (int n; (n = slots[i]->load()) != 0;)
+					impl::futex_wait(&*slots[i], n);
+		}
+		void release_writer() {
+			if (writer.exchange(0) == 2)
+				impl::futex_wake(&writer, INT_MAX);
+		}
+	public:
+		SharedMutex() = default;
+		SharedMutex(const SharedMutex&) = delete;
+		SharedMutex& operator=(const SharedMutex&) = delete;
+
+		void lock() {
+			writers.lock();
+			writer.store(1);
+			drain_readers();
+		}
+		bool try_lock() {
+			if (!writers.try_lock())
+				return false;
+			writer.store(1);
+			for (std::size_t i = 0; i < slot_count(); i++)
+				if (slots[i]->load() != 0) {
+					release_writer();
+					writers.unlock();
+					return false;
+				}
+			return true;
+		}
+		void unlock() {
+			release_writer();
+			writers.unlock();
+		}
+		void lock_shared() {
+			std::atomic<int>& readers = my_slot();
+			while (true) {
+				readers.fetch_add(1);
+				if (writer.load() == 0)
+					return;
+				leave(readers); //writers take precedence so they can't be starved
+				wait_for_writer();
+			}
+		}
+		bool try_lock_shared() {
+			std::atomic<int>& readers = my_slot();
+			readers.fetch_add(1);
+			if (writer.load() == 0)
+				return true;
+			leave(readers);
+			return false;
+		}
+		void unlock_shared() {
+			leave(my_slot());
+		}
+#ifdef CHECK_DEADLOCK
+		//exclusive side is checked as its writers mutex
+		friend const void* lock_identity(const SharedMutex& mutex) {
+			return &mutex.writers;
+		}
+#endif
+	};
+	constexpr std::size_t SharedMutex::max_slots;
 };
 
 namespace Utils {
@@ -218,57 +1024,771 @@ inline void DEBUG_WRITE(const char* name, const char* format) {
 
 namespace Concurrent {
 	class Monitorable;
-	class Thread {
-		typedef struct {
-			int id;
-			const char* name;
-		} descriptor_t;
+	class ThreadPool;
+	class FiberScheduler;
 
-		virtual void run() = 0;
-		static void fn_caller(void * arg) {
-			static_cast<Thread*>(arg)->run();
+	template <class T>
+	class Future;
+	template <class T>
+	class Promise;
+
+	namespace impl {
+		//callback run once when future's state completes
+		struct continuation_t {
+			continuation_t* next = nullptr;
+			virtual void run() = 0;
+			virtual ~continuation_t() {}
+		};
+		template <class F>
+		struct fn_continuation_t : public continuation_t {
+			F fn;
+			fn_continuation_t(F&& fn) :fn(std::move(fn)) {}
+			void run() override { fn(); }
+		};
+		template <class F>
+		continuation_t* make_continuation(F&& fn) {
+			return new fn_continuation_t<typename std::decay<F>::type>(std::forward<F>(fn));
 		}
 
-		std::thread* thread = nullptr;
-		descriptor_t descriptor;
+		struct unit_t {};
 
-		static std::atomic<int> next_id;
-		static std::mutex thread_map_mutex;
-		static std::unordered_map<std::thread::id, descriptor_t> std_thread_map;
-	protected:
-		// sleep_for alias that shall be used only from inside function so always targets this_thread
-		template< class Rep, class Period>
-		void sleep_for(const std::chrono::duration<Rep, Period>& sleep_duration) {
-			std::this_thread::sleep_for(sleep_duration);
-		}
+		/**
+		 * State shared by Promise and its Futures. Reference count, value and continuations
+		 * live in it, so a promise with any number of futures costs a single allocation.
+		 */
+		template <class T>
+		class future_state_t {
+			typedef typename std::conditional<std::is_void<T>::value, unit_t, T>::type value_t;
+
+			std::atomic<int> refs{ 1 };
+			std::atomic<bool> satisfied{ false }; //value or exception is being set
+			std::atomic<int> ready{ 0 }; //0 - pending, 1 - complete, 2 - pending with waiters parked
+			std::atomic<continuation_t*> continuations{ nullptr };
+			typename std::aligned_storage<sizeof(value_t), alignof(value_t)>::type storage;
+			bool has_value = false;
+			std::exception_ptr error;
+
+			//stands in for the continuation list once state is complete
+			continuation_t* completed() { return reinterpret_cast<continuation_t*>(this); }
+			void claim() {
+				if (satisfied.exchange(true))
+					throw std::future_error(std::future_errc::promise_already_satisfied);
+			}
+			void complete() {
+				if (ready.exchange(1) == 2)
+					futex_wake(&ready, INT_MAX);
+				//continuations were pushed in reverse
+				continuation_t* list = nullptr;
+				for (continuation_t* c = continuations.exchange(completed()); c;) {
+					continuation_t* next = c->next;
+					c->next = list;
+					list = c;
+					c = next;
+				}
+				while (continuation_t* c = list) {
+					list = c->next;
+					c->run();
+					delete c;
+				}
+			}
+		public:
+			~future_state_t() {
+				if (has_value)
+					reinterpret_cast<value_t*>(&storage)->~value_t();
+			}
+			void acquire() { refs.fetch_add(1, std::memory_order_relaxed); }
+			void release() {
+				if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					delete this;
+			}
+			bool unique() const { return refs.load() == 1; }
+			bool is_satisfied() const { return satisfied.load(); }
+			bool is_ready() const { return ready.load() == 1; }
+
+			template <class... Args>
+			void set_value(Args&&... args) {
+				claim();
+				new (&storage) value_t(std::forward<Args>(args)...);
+				has_value = true;
+				complete();
+			}
+			void set_exception(std::exception_ptr e) {
+				claim();
+				error = e;
+				complete();
+			}
+			void wait() {
+				for (int r = ready.load(); r != 1; r = ready.load())
+					if (r == 2 || ready.compare_exchange_weak(r, 2))
+						futex_wait(&ready, 2);
+			}
+			bool wait_until(const deadline_t& deadline) {
+				for (int r = ready.load(); r != 1; r = ready.load()) {
+					if (r == 0 && !ready.compare_exchange_weak(r, 2))
+						continue;
+					if (!futex_wait_until(&ready, 2, deadline) && std::chrono::steady_clock::now() >= deadline)
+						return is_ready();
+				}
+				return true;
+			}
+			//runs c once complete, right away if it already is
+			void add(continuation_t* c) {
+				continuation_t* head = continuations.load();
+				do {
+					if (head == completed()) {
+						c->run();
+						delete c;
+						return;
+					}
+					c->next = head;
+				} while (!continuations.compare_exchange_weak(head, c));
+			}
+			const std::exception_ptr& exception() const { return error; }
+			value_t& value() {
+				wait();
+				if (error)
+					std::rethrow_exception(error);
+				return *reinterpret_cast<value_t*>(&storage);
+			}
+		};
+
+		template <class T>
+		struct future_value_t {
+			typedef const T& type;
+			static const T& get(future_state_t<T>* state) { return state->value(); }
+			template <class F>
+			static auto apply(F& fn, future_state_t<T>* state) -> decltype(fn(std::declval<const T&>())) { return fn(state->value()); }
+		};
+		template <>
+		struct future_value_t<void> {
+			typedef void type;
+			static void get(future_state_t<void>* state) { state->value(); }
+			template <class F>
+			static auto apply(F& fn, future_state_t<void>* state) -> decltype(fn()) { state->value(); return fn(); }
+		};
+		//result of continuation F attached to Future<T>
+		template <class T, class F>
+		using continuation_result_t = decltype(future_value_t<T>::apply(std::declval<F&>(), nullptr));
+
+		template <class R>
+		struct fulfil_t;
+
+		//runs continuations on the thread that completes the future
+		struct inline_executor_t {
+			template <class F>
+			void execute(F&& fn) { fn(); }
+		};
+	}
+
+	/**
+	 * Result of asynchronous operation. Copies share the state, so any number of
+	 * threads may wait on it or chain continuations to it.
+	 */
+	template <class T>
+	class Future {
+		impl::future_state_t<T>* state = nullptr;
+
+		template <class U>
+		friend class Promise;
+		template <class U>
+		friend class Future;
+		explicit Future(impl::future_state_t<T>* state) :state(state) { state->acquire(); }
+		void check() const {
+			if (!state)
+				throw std::future_error(std::future_errc::no_state);
+		}
+	public:
+		Future() = default;
+		Future(const Future& other) :state(other.state) {
+			if (state)
+				state->acquire();
+		}
+		Future(Future&& other) :state(other.state) { other.state = nullptr; }
+		Future& operator=(Future other) {
+			std::swap(state, other.state);
+			return *this;
+		}
+		~Future() {
+			if (state)
+				state->release();
+		}
+		/**
+		 * @return bool false for default constructed future
+		 */
+		bool valid() const { return state != nullptr; }
+		/**
+		 * @return bool true if value or exception has been set
+		 */
+		bool is_ready() const { check(); return state->is_ready(); }
+		void wait() const { check(); state->wait(); }
+		/**
+		 * @return bool false if deadline passed before future became ready
+		 */
+		template <class Clock, class Duration>
+		bool wait_until(const std::chrono::time_point<Clock, Duration>& abs_time) const {
+			check();
+			return state->wait_until(impl::to_deadline(abs_time));
+		}
+		template <class Rep, class Period>
+		bool wait_for(const std::chrono::duration<Rep, Period>& rel_time) const {
+			return wait_until(std::chrono::steady_clock::now() + rel_time);
+		}
+		/**
+		 * Waits for the result and returns it, rethrows exception if one was set instead
+		 */
+		typename impl::future_value_t<T>::type get() const {
+			check();
+			return impl::future_value_t<T>::get(state);
+		}
+		/**
+		 * Runs fn(value) (fn() for Future<void>) through executor once this future is ready.
+		 * Exception set on this future skips fn and is passed to the returned future.
+		 * Executor needs execute(callable), ThreadPool is one.
+		 * @return Future Result of fn
+		 */
+		template <class E, class F>
+		Future<impl::continuation_result_t<T, F>> then(E& executor, F&& fn) const {
+			typedef impl::continuation_result_t<T, F> result_t;
+			check();
+			Promise<result_t> promise;
+			Future<result_t> result = promise.get_future();
+			Future self(*this);
+			E* ex = &executor;
+			state->add(impl::make_continuation([ex, self, promise = std::move(promise), fn = typename std::decay<F>::type(std::forward<F>(fn))]() mutable {
+				ex->execute([self, promise = std::move(promise), fn = std::move(fn)]() mutable {
+					if (self.state->exception()) {
+						promise.set_exception(self.state->exception());
+						return;
+					}
+					auto call = [&] { return impl::future_value_t<T>::apply(fn, self.state); };
+					impl::fulfil_t<result_t>::call(promise, call);
+				});
+			}));
+			return result;
+		}
+		/**
+		 * Same as then(executor, fn) but runs fn on the thread that completes this future
+		 */
+		template <class F>
+		Future<impl::continuation_result_t<T, F>> then(F&& fn) const {
+			static impl::inline_executor_t executor;
+			return then(executor, std::forward<F>(fn));
+		}
+		/**
+		 * Runs fn() once this future is ready, on the thread that completes it
+		 */
+		template <class F>
+		void on_ready(F&& fn) const {
+			check();
+			state->add(impl::make_continuation(std::forward<F>(fn)));
+		}
+	};
+
+	/**
+	 * Producing side of Future. Promise destroyed without setting a result
+	 * sets std::future_error(broken_promise) instead.
+	 */
+	template <class T>
+	class Promise {
+		impl::future_state_t<T>* state;
+	public:
+		Promise() :state(new impl::future_state_t<T>()) {}
+		Promise(Promise&& other) :state(other.state) { other.state = nullptr; }
+		Promise& operator=(Promise&& other) {
+			std::swap(state, other.state);
+			return *this;
+		}
+		Promise(const Promise&) = delete;
+		Promise& operator=(const Promise&) = delete;
+		~Promise() {
+			if (!state)
+				return;
+			if (!state->is_satisfied())
+				state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+			state->release();
+		}
+		/**
+		 * Can be called any number of times, all futures share the result
+		 */
+		Future<T> get_future() const { return Future<T>(state); }
+		/**
+		 * Sets the result, throws std::future_error if it was already set
+		 */
+		template <class... Args>
+		void set_value(Args&&... args) { state->set_value(std::forward<Args>(args)...); }
+		void set_exception(std::exception_ptr error) { state->set_exception(error); }
+	};
+
+	namespace impl {
+		//sets promise to result of fn() or to exception it throws
+		template <class R>
+		struct fulfil_t {
+			template <class F>
+			static void call(Promise<R>& promise, F& fn) {
+				try {
+					promise.set_value(fn());
+				}
+				catch (...) {
+					promise.set_exception(std::current_exception());
+				}
+			}
+		};
+		template <>
+		struct fulfil_t<void> {
+			template <class F>
+			static void call(Promise<void>& promise, F& fn) {
+				try {
+					fn();
+				}
+				catch (...) {
+					promise.set_exception(std::current_exception());
+					return;
+				}
+				promise.set_value();
+			}
+		};
+	}
+
+	/**
+	 * @return Future that is already ready with value
+	 */
+	template <class T>
+	Future<typename std::decay<T>::type> make_ready_future(T&& value) {
+		Promise<typename std::decay<T>::type> promise;
+		promise.set_value(std::forward<T>(value));
+		return promise.get_future();
+	}
+	inline Future<void> make_ready_future() {
+		Promise<void> promise;
+		promise.set_value();
+		return promise.get_future();
+	}
+
+	/**
+	 * @return Future that becomes ready when all futures in [first, last) are ready,
+	 * with the first exception set on any of them
+	 */
+	template <class Iterator>
+	Future<void> when_all(Iterator first, Iterator last) {
+		struct join_t {
+			Promise<void> promise;
+			std::atomic<std::size_t> remaining;
+			std::atomic<bool> failed{ false };
+			std::exception_ptr error;
+			join_t(std::size_t count) :remaining(count) {}
+		};
+		const std::size_t count = std::distance(first, last);
+		if (count == 0)
+			return make_ready_future();
+		auto join = std::make_shared<join_t>(count);
+		Future<void> result = join->promise.get_future();
+		for (Iterator it = first; it != last; ++it) {
+			auto future = *it;
+			future.on_ready([join, future] {
+				try {
+					future.get();
+				}
+				catch (...) {
+					if (!join->failed.exchange(true))
+						join->error = std::current_exception();
+				}
+				if (join->remaining.fetch_sub(1) == 1) {
+					if (join->error)
+						join->promise.set_exception(join->error);
+					else
+						join->promise.set_value();
+				}
+			});
+		}
+		return result;
+	}
+	/**
+	 * @return Future with index (from first) of the first future in [first, last) that became ready,
+	 * std::invalid_argument for empty range
+	 */
+	template <class Iterator>
+	Future<std::size_t> when_any(Iterator first, Iterator last) {
+		struct race_t {
+			Promise<std::size_t> promise;
+			std::atomic<bool> decided{ false };
+		};
+		auto race = std::make_shared<race_t>();
+		Future<std::size_t> result = race->promise.get_future();
+		if (first == last)
+			race->promise.set_exception(std::make_exception_ptr(std::invalid_argument("when_any of no futures")));
+		std::size_t index = 0;
+		for (Iterator it = first; it != last; ++it, ++index)
+			it->on_ready([race, index] {
+				if (!race->decided.exchange(true))
+					race->promise.set_value(index);
+			});
+		return result;
+	}
+
+	namespace impl {
+#ifdef __linux__
+		//cpus of NUMA node as listed by sysfs (e.g. "0-3,8-11"), empty if node doesn't exist
+		inline std::vector<int> numa_node_cpus(int node) {
+			std::vector<int> cpus;
+			char path[64];
+			snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+			FILE* file = fopen(path, "r");
+			if (!file)
+				return cpus;
+			for (int first, last, c; fscanf(file, "%d", &first) == 1;) {
+				last = first;
+				if ((c = fgetc(file)) == '-') {
+					if (fscanf(file, "%d", &last) != 1)
+						break;
+					c = fgetc(file);
+				}
+				for (int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+				if (c != ',')
+					break;
+			}
+			fclose(file);
+			return cpus;
+		}
+		//makes calling thread allocate memory on node when it can, failure is ignored as it is only a preference
+		inline void prefer_numa_node(int node) {
+			constexpr int mpol_preferred = 1; //MPOL_PREFERRED from linux/mempolicy.h
+			unsigned long mask[16] = {};
+			if (node < 0 || node >= static_cast<int>(sizeof(mask) * CHAR_BIT))
+				return;
+			mask[node / (sizeof(unsigned long) * CHAR_BIT)] |= 1UL << (node % (sizeof(unsigned long) * CHAR_BIT));
+			syscall(SYS_set_mempolicy, mpol_preferred, mask, sizeof(mask) * CHAR_BIT);
+		}
+#endif
+	}
+
+	class Thread {
+	public:
+		/**
+		 * Placement and scheduling of thread, applied before its run() starts.
+		 * Honoured on Linux, elsewhere threads start with platform defaults.
+		 */
+		struct options_t {
+			enum policy_t { DEFAULT, FIFO, ROUND_ROBIN, BATCH, IDLE };
+
+			std::vector<int> cpus;      //cpus thread may run on, empty means any
+			int numa_node = -1;         //preferred NUMA node for memory, and for cpus when none are given. -1 means none
+			policy_t policy = DEFAULT;  //FIFO and ROUND_ROBIN are real-time policies and usually need privileges
+			int priority = 0;           //static priority for FIFO and ROUND_ROBIN, 1-99 on Linux
+			std::size_t stack_size = 0; //0 means platform default
+
+			bool is_default() const {
+				return cpus.empty() && numa_node < 0 && policy == DEFAULT && stack_size == 0;
+			}
+		};
+	private:
+		typedef struct {
+			int id;
+			const char* name;
+		} descriptor_t;
+
+		/**
+		 * Registry entry of a running thread. Entries are never freed, a thread takes over
+		 * a free one or pushes a new one to the front of the list, so enumerating needs no lock.
+		 */
+		struct record_t {
+			std::atomic<bool> published{ false }; //fields below are filled in
+			std::atomic<int> id{ -1 };
+			std::atomic<const char*> name{ "" };
+			std::atomic<std::thread::id> std_id{ std::thread::id() };
+			record_t* next = nullptr; //immutable once in list
+			std::uint32_t index = 0; //position in record chunks
+			std::atomic<std::uint32_t> free_next{ 0 }; //index + 1 of next free record, 0 ends the stack
+		};
+
+		virtual void run() = 0;
+		static void fn_caller(void * arg) {
+			static_cast<Thread*>(arg)->execute();
+		}
+		//runs run() on calling thread with this thread's descriptor registered
+		void execute() {
+			struct registration_t {
+				Thread* self;
+				record_t* previous = current_record();
+				registration_t(Thread* self) :self(self) {
+					record_t* rec = acquire_record(self->descriptor);
+					self->record.store(rec);
+					current_record() = rec;
+				}
+				~registration_t() {
+					release_record(self->record.exchange(nullptr));
+					current_record() = previous;
+				}
+			} registration(this);
+			try {
+				run();
+			}
+			catch (...) {
+				finished.set_exception(std::current_exception());
+				throw;
+			}
+			finished.set_value();
+		}
+
+		std::thread* thread = nullptr;
+		descriptor_t descriptor;
+		std::atomic<record_t*> record{ nullptr }; //while running
+		Promise<void> finished; //set when run() returns
+
+		//new promise for a restarted thread, before it is launched so done() never races with or misses the reset
+		void reset_finished() {
+			if (finished.get_future().is_ready())
+				finished = Promise<void>();
+		}
+		options_t options;
+#ifdef __linux__
+		//threads with non-default options are created directly through pthread
+		pthread_t native_thread;
+		bool native = false;
+		static constexpr int policy_pending = -1;
+		std::atomic<int> policy_error{ 0 }; //errno of a policy the thread sets itself, policy_pending until it has tried
+
+		static int native_policy(options_t::policy_t policy) {
+			static const int policies[] = { SCHED_OTHER, SCHED_FIFO, SCHED_RR, SCHED_BATCH, SCHED_IDLE };
+			return policies[policy];
+		}
+		static void* native_caller(void* arg) {
+			Thread* self = static_cast<Thread*>(arg);
+			if (self->options.numa_node >= 0)
+				impl::prefer_numa_node(self->options.numa_node);
+			//pthread attributes accept only real-time policies, others are set by the thread itself and reported to start()
+			if (self->options.policy == options_t::BATCH || self->options.policy == options_t::IDLE) {
+				sched_param param{};
+				const int error = sched_setscheduler(0, native_policy(self->options.policy), &param) == 0 ? 0 : errno;
+				self->policy_error.store(error);
+				impl::futex_wake(&self->policy_error, 1);
+				if (error)
+					return nullptr;
+			}
+			self->execute();
+			return nullptr;
+		}
+		void start_native() {
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			if (options.stack_size)
+				pthread_attr_setstacksize(&attr, std::max<std::size_t>(options.stack_size, PTHREAD_STACK_MIN));
+			const std::vector<int> cpus = options.cpus.empty() && options.numa_node >= 0 ? impl::numa_node_cpus(options.numa_node) : options.cpus;
+			if (!cpus.empty()) {
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				for (int cpu : cpus)
+					if (cpu >= 0 && cpu < CPU_SETSIZE)
+						CPU_SET(cpu, &set);
+				pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+			}
+			if (options.policy == options_t::FIFO || options.policy == options_t::ROUND_ROBIN) {
+				sched_param param{};
+				param.sched_priority = options.priority;
+				pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+				pthread_attr_setschedpolicy(&attr, native_policy(options.policy));
+				pthread_attr_setschedparam(&attr, &param);
+			}
+			policy_error.store(policy_pending);
+			const int error = pthread_create(&native_thread, &attr, Thread::native_caller, this);
+			pthread_attr_destroy(&attr);
+			if (error)
+				throw std::system_error(error, std::system_category(), "Thread::start");
+			if (options.policy == options_t::BATCH || options.policy == options_t::IDLE) {
+				int policy;
+				while ((policy = policy_error.load()) == policy_pending)
+					impl::futex_wait(&policy_error, policy);
+				if (policy) {
+					pthread_join(native_thread, nullptr); //thread returned without running
+					throw std::system_error(policy, std::system_category(), "Thread::start");
+				}
+			}
+			native = true;
+		}
+#endif
+
+		static std::atomic<int> next_id;
+		static std::atomic<record_t*> registry;
+
+#ifdef __linux__
+		__attribute__((noinline)) //fiber running execute() may resume on another thread
+#endif
+		static record_t*& current_record() {
+			static thread_local record_t* rec = nullptr;
+#ifdef __linux__
+			asm volatile("");
+#endif
+			return rec;
+		}
+		/**
+		 * Entries released by finished threads are kept on a lock-free stack, so that starting
+		 * doesn't scan the registry. Entries are addressed by index, chunk c holds 2^c of them
+		 * starting at index 2^c - 1. Top of the stack packs index + 1 of the top entry with
+		 * a count of pops, so a pop that read a stale top fails once the entry was taken and
+		 * released in between (ABA).
+		 */
+		static constexpr int record_chunks = 32;
+		static std::atomic<record_t*> chunks[record_chunks];
+		static std::atomic<std::uint32_t> record_count;
+		static std::atomic<std::uint64_t> free_top;
+
+		static int chunk_of(std::uint32_t index) {
+			int chunk = 0;
+			while ((std::uint64_t(2) << chunk) - 1 <= index)
+				chunk++;
+			return chunk;
+		}
+		static record_t* record_at(std::uint32_t index) {
+			const int chunk = chunk_of(index);
+			return &chunks[chunk].load()[index - ((std::uint32_t(1) << chunk) - 1)];
+		}
+		static record_t* new_record() {
+			const std::uint32_t index = record_count.fetch_add(1);
+			const int chunk = chunk_of(index);
+			record_t* base = chunks[chunk].load();
+			if (!base) {
+				record_t* fresh = new record_t[std::size_t(1) << chunk];
+				if (chunks[chunk].compare_exchange_strong(base, fresh))
+					base = fresh;
+				else
+					delete[] fresh;
+			}
+			record_t* rec = &base[index - ((std::uint32_t(1) << chunk) - 1)];
+			rec->index = index;
+			rec->next = registry.load();
+			while (!registry.compare_exchange_weak(rec->next, rec));
+			return rec;
+		}
+		static record_t* acquire_record(const descriptor_t& descriptor) {
+			record_t* rec = nullptr;
+			for (std::uint64_t top = free_top.load(); static_cast<std::uint32_t>(top) != 0;) {
+				record_t* candidate = record_at(static_cast<std::uint32_t>(top) - 1);
+				const std::uint64_t next = ((top >> 32) + 1) << 32 | candidate->free_next.load();
+				if (free_top.compare_exchange_weak(top, next)) {
+					rec = candidate;
+					break;
+				}
+			}
+			if (!rec)
+				rec = new_record();
+			rec->id.store(descriptor.id);
+			rec->name.store(descriptor.name);
+			rec->std_id.store(std::this_thread::get_id());
+			rec->published.store(true);
+			return rec;
+		}
+		static void release_record(record_t* rec) {
+			rec->published.store(false);
+			std::uint64_t top = free_top.load();
+			do
+				rec->free_next.store(static_cast<std::uint32_t>(top));
+			while (!free_top.compare_exchange_weak(top, (top >> 32) << 32 | (rec->index + 1)));
+		}
+		static descriptor_t to_descriptor(const record_t* rec) {
+			return { rec->id.load(), rec->name.load() };
+		}
+	protected:
+		// sleep_for alias that shall be used only from inside function so always targets this_thread
+		template< class Rep, class Period>
+		void sleep_for(const std::chrono::duration<Rep, Period>& sleep_duration) {
+#ifdef __linux__
+			if (impl::current_fiber()) {
+				//suspends only the fiber, nobody wakes the word so it waits out the deadline
+				std::atomic<int> word{ 0 };
+				const impl::deadline_t deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(sleep_duration);
+				while (std::chrono::steady_clock::now() < deadline)
+					impl::futex_wait_until(&word, 0, deadline);
+				return;
+			}
+#endif
+			std::this_thread::sleep_for(sleep_duration);
+		}
 		// allow the user to change thread's name whenever he wants as it is useful for debugging
 		void set_name(const char* name) {
 			descriptor.name = name;
-			if (thread) {
-				std::unique_lock<std::mutex> lock(thread_map_mutex);
-				std_thread_map[thread->get_id()] = descriptor;
-			}
+			if (record_t* rec = record.load())
+				rec->name.store(name);
 		}
 		descriptor_t get_descriptor() const {
 			return descriptor;
 		}
 		//needed for condition printing, TODO: consider putting in private to hide inner implementaiton
 		static descriptor_t get_descriptor(std::thread::id std_thread_id) {
-			std::unique_lock<std::mutex> lock(thread_map_mutex);
-			return std_thread_map[std::this_thread::get_id()];
+			if (std_thread_id == std::this_thread::get_id())
+				return current_descriptor();
+			for (record_t* rec = registry.load(); rec; rec = rec->next)
+				if (rec->published.load() && rec->std_id.load() == std_thread_id)
+					return to_descriptor(rec);
+			return { -1, "" };
+		}
+		/**
+		 * Descriptor of calling thread, id -1 if it wasn't started through Thread
+		 */
+		static descriptor_t current_descriptor() {
+			const record_t* rec = current_record();
+			return rec ? to_descriptor(rec) : descriptor_t{ -1, "" };
 		}
 		friend class Monitorable;
+		friend class ThreadPool;
+		friend class FiberScheduler;
+#ifdef __linux__
+		friend struct impl::fiber_t;
+#endif
+#ifdef CHECK_DEADLOCK
+		friend struct impl::lock_checker_t;
+#endif
 	public:
 		Thread(const char* name = "") :descriptor({ next_id++,name }) {}
+		//copies are not registered, registration belongs to the object whose run() is executing
+		Thread(const Thread& rhs) :thread(rhs.thread), descriptor(rhs.descriptor), options(rhs.options) {}
+		Thread& operator=(const Thread& rhs) {
+			thread = rhs.thread;
+			descriptor = rhs.descriptor;
+			options = rhs.options;
+			return *this;
+		}
+		/**
+		 * Future that becomes ready when run() returns, or holds the exception it threw.
+		 * Refers to the latest start of the thread.
+		 */
+		Future<void> done() const {
+			return finished.get_future();
+		}
+		/**
+		 * Sets placement and scheduling for the next start()
+		 */
+		void set_options(const options_t& options) {
+			this->options = options;
+		}
+		/**
+		 * Starts the thread. On Linux throws std::system_error if it can't be created
+		 * with requested options, e.g. real-time policy without privileges. BATCH and IDLE
+		 * are set by the new thread itself, start() waits until it has tried and if that
+		 * failed throws as well, without running run().
+		 */
 		void start() {
-			thread = new std::thread(Thread::fn_caller, this);
-			std::unique_lock<std::mutex> lock(thread_map_mutex);
-			std_thread_map[thread->get_id()] = descriptor;
+			reset_finished();
+#ifdef __linux__
+			if (!options.is_default())
+				start_native();
+			else
+#endif
+				thread = new std::thread(Thread::fn_caller, this);
 #ifdef DEBUG_THREAD
 			DEBUG_WRITE("thread[#%d] %s", "started", descriptor.id, descriptor.name);
 #endif
 		}
 		void join() {
+#ifdef __linux__
+			if (native) {
+#ifdef DEBUG_THREAD
+				DEBUG_WRITE("thread[#%d] %s", "joined", descriptor.id, descriptor.name);
+#endif
+				pthread_join(native_thread, nullptr);
+				native = false;
+				return;
+			}
+#endif
 			if (thread && thread->joinable()) {
 #ifdef DEBUG_THREAD
 				DEBUG_WRITE("thread[#%d] %s", "joined", descriptor.id, descriptor.name);
@@ -278,6 +1798,10 @@ namespace Concurrent {
 		}
 		virtual ~Thread() {
 			//join() removed. Library shouldn't enforce this and can create seg. faults
+#ifdef __linux__
+			if (native)
+				pthread_detach(native_thread);
+#endif
 			if (thread) {
 				delete thread;
 #ifdef DEBUG_THREAD
@@ -285,299 +1809,3848 @@ namespace Concurrent {
 #endif
 			}
 		}
+		/**
+		 * Calls fn(id, name) for every thread currently running a Thread's run(), for diagnostic dumps.
+		 * Takes no lock, threads starting or finishing meanwhile may or may not be seen.
+		 */
+		template <class F>
+		static void for_each_running(F&& fn) {
+			for (record_t* rec = registry.load(); rec; rec = rec->next)
+				if (rec->published.load()) {
+					descriptor_t descriptor = to_descriptor(rec);
+					fn(descriptor.id, descriptor.name);
+				}
+		}
 	};
 	std::atomic<int> Thread::next_id{ 0 };
-	std::mutex Thread::thread_map_mutex{};
-	std::unordered_map<std::thread::id, Thread::descriptor_t> Thread::std_thread_map{};
-
-	typedef unsigned int uint;
-
-	template <class T>
-	class Monitor;
-
-	/**
-	 * Parent class for all classes that are candidates to become monitor
-	 */
-	class Monitorable {
-	protected:
-		class cond {
-			struct node_t {
-				uint rank;
-				sem_t* sem;
+	std::atomic<Thread::record_t*> Thread::registry{ nullptr };
+	constexpr int Thread::record_chunks;
+	std::atomic<Thread::record_t*> Thread::chunks[Thread::record_chunks] = {};
+	std::atomic<std::uint32_t> Thread::record_count{ 0 };
+	std::atomic<std::uint64_t> Thread::free_top{ 0 };
+#ifdef __linux__
+	constexpr int Thread::policy_pending;
+#endif
 
-				node_t(uint rank) :rank(rank) {
-					sem = new sem_t(0);
+#ifdef CHECK_DEADLOCK
+	namespace impl {
+		inline lock_checker_t::graph_t& lock_checker_t::graph() {
+			static graph_t* graph = new graph_t; //outlives static locks destroyed at exit
+			return *graph;
+		}
+		inline std::atomic<lock_checker_t::thread_state_t*>& lock_checker_t::registry() {
+			static std::atomic<thread_state_t*> registry{ nullptr };
+			return registry;
+		}
+		inline lock_checker_t::thread_state_t* lock_checker_t::state() {
+#ifdef __linux__
+			if (current_fiber())
+				return nullptr;
+#endif
+			static thread_local bool exited = false; //locks may still be used by other thread local destructors
+			if (exited)
+				return nullptr;
+			struct registration_t {
+				thread_state_t* state = nullptr;
+				registration_t() {
+					for (thread_state_t* entry = registry().load(); entry && !state; entry = entry->next) {
+						bool expected = false;
+						if (!entry->in_use.load() && entry->in_use.compare_exchange_strong(expected, true))
+							state = entry;
+					}
+					if (!state) {
+						state = new thread_state_t;
+						state->in_use.store(true);
+						state->next = registry().load();
+						while (!registry().compare_exchange_weak(state->next, state));
+					}
+					const auto descriptor = Thread::current_descriptor();
+					state->id.store(descriptor.id);
+					state->name.store(descriptor.name);
 				}
-				~node_t() {
-					delete sem;
+				~registration_t() {
+					exited = true;
+					state->depth.store(0);
+					state->blocked_on.store(nullptr);
+					state->overflow = 0;
+					state->edges.clear();
+					state->signalling.clear();
+					state->in_use.store(false);
 				}
 			};
-			//TODO: sorting is not stable by default (STL spec), offer the ability to make it stable
-			struct compare_node_ptr {
-				bool operator() (node_t* n1, node_t* n2) {
-					return n1->rank > n2->rank; //smaller number => higher priority
+			static thread_local registration_t registration;
+			return registration.state;
+		}
+		inline void lock_checker_t::refresh(thread_state_t* state) {
+			const std::uint64_t epoch = graph().epoch.load();
+			if (state->epoch != epoch) {
+				state->edges.clear();
+				state->signalling.clear();
+				state->epoch = epoch;
+			}
+		}
+		inline std::atomic<std::uint64_t>& lock_checker_t::known_bit(graph_t& graph, const void* lock, std::uint64_t& mask) {
+			const std::size_t hash = (reinterpret_cast<std::uintptr_t>(lock) >> 3) * 0x9E3779B97F4A7C15ull >> 52; //12 bits
+			mask = std::uint64_t(1) << (hash % 64);
+			return graph.known[hash / 64 % 64];
+		}
+		inline bool lock_checker_t::remove(thread_state_t* state, const void* lock) {
+			const int depth = state->depth.load(std::memory_order_relaxed);
+			for (int i = depth - 1; i >= 0; i--)
+				if (state->held[i].lock.load(std::memory_order_relaxed) == lock) {
+					for (int j = i; j + 1 < depth; j++) {
+						state->held[j].lock.store(state->held[j + 1].lock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+						state->held[j].kind.store(state->held[j + 1].kind.load(std::memory_order_relaxed), std::memory_order_relaxed);
+					}
+					state->depth.store(depth - 1, std::memory_order_release);
+					return true;
+				}
+			return false;
+		}
+		inline bool lock_checker_t::find_path(graph_t& graph, const void* from, const void* to, std::unordered_set<const void*>& visited, std::vector<std::pair<const void*, const edge_t*>>& path) {
+			if (from == to)
+				return true;
+			auto node = graph.nodes.find(from);
+			if (node == graph.nodes.end() || node->second.signalling || !visited.insert(from).second)
+				return false;
+			for (const edge_t& edge : node->second.edges) {
+				path.emplace_back(from, &edge);
+				if (find_path(graph, edge.to, to, visited, path))
+					return true;
+				path.pop_back();
+			}
+			return false;
+		}
+		inline void lock_checker_t::add_edge(thread_state_t* state, const void* from, const char* from_kind, const void* to, const char* to_kind) {
+			state->busy = true;
+			const auto descriptor = Thread::current_descriptor();
+			std::string report;
+			{
+				graph_t& graph = lock_checker_t::graph();
+				std::unique_lock<std::mutex> lock(graph.mutex);
+				node_t& source = graph.nodes[from];
+				node_t& target = graph.nodes[to];
+				source.kind = from_kind;
+				target.kind = to_kind;
+				std::uint64_t mask;
+				known_bit(graph, from, mask).fetch_or(mask);
+				known_bit(graph, to, mask).fetch_or(mask);
+				if (std::none_of(source.edges.begin(), source.edges.end(), [to](const edge_t& edge) { return edge.to == to; })) {
+					std::unordered_set<const void*> visited;
+					std::vector<std::pair<const void*, const edge_t*>> path;
+					if (!source.signalling && !target.signalling && find_path(graph, to, from, visited, path)) {
+						std::ostringstream out;
+						out << "possible deadlock, thread[#" << descriptor.id << "] " << descriptor.name << " takes " << to_kind << " " << to << " while holding " << from_kind << " " << from;
+						for (const auto& step : path)
+							out << "\n\t" << graph.nodes[step.second->to].kind << " " << step.second->to << " was taken while holding " << graph.nodes[step.first].kind << " " << step.first
+								<< " by thread[#" << step.second->thread_id << "] " << step.second->thread_name;
+						report = out.str();
+					}
+					source.edges.push_back({ to, descriptor.id, descriptor.name });
+				}
+			}
+			if (!report.empty())
+				DEBUG_WRITE("lock order", "%s", report.c_str());
+			state->busy = false;
+		}
+		inline void lock_checker_t::acquiring(const void* lock, const char* kind) {
+			thread_state_t* state = lock_checker_t::state();
+			if (!state || state->busy)
+				return;
+			const int depth = state->depth.load(std::memory_order_relaxed);
+			if (depth == 0)
+				return;
+			refresh(state);
+			for (int i = 0; i < depth; i++) {
+				const void* held = state->held[i].lock.load(std::memory_order_relaxed);
+				if (held != lock && state->edges.insert({ held, lock }).second)
+					add_edge(state, held, state->held[i].kind.load(std::memory_order_relaxed), lock, kind);
+			}
+		}
+		inline void lock_checker_t::acquired(const void* lock, const char* kind) {
+			thread_state_t* state = lock_checker_t::state();
+			if (!state || state->busy)
+				return;
+			int depth = state->depth.load(std::memory_order_relaxed);
+			if (depth == max_held) {
+				//makes room by forgetting the oldest semaphore, likely one that serves for signalling
+				int i = 0;
+				while (i < depth && std::strcmp(state->held[i].kind.load(std::memory_order_relaxed), "semaphore") != 0)
+					i++;
+				if (i == depth) {
+					state->overflow++;
+					return;
+				}
+				remove(state, state->held[i].lock.load(std::memory_order_relaxed));
+				depth--;
+			}
+			state->held[depth].lock.store(lock, std::memory_order_relaxed);
+			state->held[depth].kind.store(kind, std::memory_order_relaxed);
+			state->depth.store(depth + 1, std::memory_order_release);
+		}
+		inline void lock_checker_t::released(const void* lock) {
+			thread_state_t* state = lock_checker_t::state();
+			if (!state || state->busy)
+				return;
+			if (!remove(state, lock) && state->overflow > 0)
+				state->overflow--;
+		}
+		inline void lock_checker_t::signalled(const void* lock) {
+			thread_state_t* state = lock_checker_t::state();
+			if (!state || state->busy || remove(state, lock))
+				return;
+			refresh(state);
+			if (!state->signalling.insert(lock).second)
+				return;
+			state->busy = true;
+			{
+				graph_t& graph = lock_checker_t::graph();
+				std::unique_lock<std::mutex> guard(graph.mutex);
+				node_t& node = graph.nodes[lock];
+				node.kind = "semaphore";
+				node.signalling = true;
+				std::uint64_t mask;
+				known_bit(graph, lock, mask).fetch_or(mask);
+			}
+			state->busy = false;
+		}
+		inline void lock_checker_t::destroyed(const void* lock) {
+			graph_t& graph = lock_checker_t::graph();
+			std::uint64_t mask;
+			if (!(known_bit(graph, lock, mask).load() & mask))
+				return;
+			thread_state_t* state = lock_checker_t::state();
+			if (state && state->busy)
+				return;
+			if (state)
+				state->busy = true;
+			{
+				std::unique_lock<std::mutex> guard(graph.mutex);
+				if (graph.nodes.erase(lock)) {
+					for (auto& node : graph.nodes) {
+						auto& edges = node.second.edges;
+						edges.erase(std::remove_if(edges.begin(), edges.end(), [lock](const edge_t& edge) { return edge.to == lock; }), edges.end());
+					}
+					graph.epoch.fetch_add(1); //address may be reused by another lock, threads drop their caches
 				}
+			}
+			if (state)
+				state->busy = false;
+		}
+		inline lock_checker_t::wait_t::wait_t(const void* on, const char* kind, const char* name, int rank) :state(lock_checker_t::state()) {
+			if (!state || state->busy) {
+				state = nullptr;
+				return;
+			}
+			const auto descriptor = Thread::current_descriptor(); //name might have changed since registration
+			state->id.store(descriptor.id, std::memory_order_relaxed);
+			state->name.store(descriptor.name, std::memory_order_relaxed);
+			state->blocked_kind.store(kind, std::memory_order_relaxed);
+			state->blocked_name.store(name, std::memory_order_relaxed);
+			state->blocked_rank.store(rank, std::memory_order_relaxed);
+			state->blocked_since.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+			state->blocked_on.store(on, std::memory_order_release);
+		}
+		inline lock_checker_t::wait_t::~wait_t() {
+			if (state)
+				state->blocked_on.store(nullptr, std::memory_order_release);
+		}
+		inline void lock_checker_t::dump() {
+			struct waiter_t {
+				int id;
+				const char* name;
+				const void* on;
+				const char* kind;
+				const char* label;
+				int rank;
+				std::chrono::steady_clock::rep since;
+				std::vector<std::pair<const void*, const char*>> held;
+				int holder; //index of thread holding the lock waited on, -1 if none found
 			};
+			thread_state_t* self = state();
+			if (self)
+				self->busy = true;
+			std::vector<waiter_t> threads;
+			for (thread_state_t* state = registry().load(); state; state = state->next) {
+				if (!state->in_use.load())
+					continue;
+				waiter_t thread{ state->id.load(), state->name.load(), state->blocked_on.load(std::memory_order_acquire),
+					state->blocked_kind.load(), state->blocked_name.load(), state->blocked_rank.load(), state->blocked_since.load(), {}, -1 };
+				const int depth = std::min(state->depth.load(std::memory_order_acquire), static_cast<int>(max_held));
+				for (int i = 0; i < depth; i++)
+					thread.held.emplace_back(state->held[i].lock.load(std::memory_order_relaxed), state->held[i].kind.load(std::memory_order_relaxed));
+				threads.push_back(std::move(thread));
+			}
+			for (std::size_t i = 0; i < threads.size(); i++)
+				for (std::size_t j = 0; j < threads.size() && threads[i].on && threads[i].holder < 0; j++)
+					if (j != i && std::any_of(threads[j].held.begin(), threads[j].held.end(), [&](const std::pair<const void*, const char*>& held) { return held.first == threads[i].on; }))
+						threads[i].holder = static_cast<int>(j);
 
-			mutex_t* & monitor_mutex;
-			std::priority_queue < node_t*, std::vector<node_t*>, compare_node_ptr > thq;
-			std::mutex mutex;
-			const char* name;
-		public:
-			cond(mutex_t* & monitor_mutex, const char * name = "") : monitor_mutex(monitor_mutex), name(name) {
-#ifdef DEBUG_COND
-				DEBUG_WRITE("condition %s", "created", name);
+			std::ostringstream out;
+			const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+			int blocked = 0;
+			for (const waiter_t& thread : threads) {
+				if (!thread.on)
+					continue;
+				blocked++;
+				const std::chrono::duration<double> waited = std::chrono::steady_clock::duration(now - thread.since);
+				out << "\n\tthread[#" << thread.id << "] " << thread.name << " blocked " << waited.count() << "s on " << thread.kind << " ";
+				if (*thread.label)
+					out << thread.label << " ";
+				out << thread.on;
+				if (thread.rank >= 0)
+					out << " rank " << thread.rank;
+				if (thread.holder >= 0)
+					out << " held by thread[#" << threads[thread.holder].id << "] " << threads[thread.holder].name;
+				for (std::size_t i = 0; i < thread.held.size(); i++)
+					out << (i ? ", " : ", holding ") << thread.held[i].second << " " << thread.held[i].first;
+			}
+			//threads waiting for each other, each waits on lock held by the next one
+			std::vector<int> visited(threads.size(), -1);
+			for (std::size_t start = 0; start < threads.size(); start++) {
+				int i = static_cast<int>(start);
+				while (i >= 0 && visited[i] < 0) {
+					visited[i] = static_cast<int>(start);
+					i = threads[i].on ? threads[i].holder : -1;
+				}
+				if (i < 0 || visited[i] != static_cast<int>(start))
+					continue;
+				out << "\n\tdeadlock: ";
+				int j = i;
+				do {
+					out << "thread[#" << threads[j].id << "] " << threads[j].name << " -> ";
+					j = threads[j].holder;
+				} while (j != i);
+				out << "thread[#" << threads[i].id << "] " << threads[i].name;
+			}
+			DEBUG_WRITE("watchdog", "%d blocked threads%s", blocked, out.str().c_str());
+			if (self)
+				self->busy = false;
+		}
+	}
 #endif
+
+	/**
+	 * Reports threads that stay blocked on Mutex, Semaphore or cond longer than stall, listing
+	 * every blocked thread with the locks it holds and threads that wait for each other.
+	 * Needs CHECK_DEADLOCK defined, without it the watchdog does nothing.
+	 */
+	class DeadlockWatchdog {
+#ifdef CHECK_DEADLOCK
+		std::chrono::steady_clock::duration stall;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		bool stopping = false;
+		std::thread thread;
+
+		void watch() {
+			const std::chrono::steady_clock::duration period = std::max<std::chrono::steady_clock::duration>(stall / 4, std::chrono::milliseconds(10));
+			std::unordered_map<const void*, std::chrono::steady_clock::rep> reported; //wait already reported for each thread
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!wakeup.wait_for(lock, period, [this] { return stopping; })) {
+				const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+				bool stalled = false;
+				for (auto* state = impl::lock_checker_t::registry().load(); state; state = state->next)
+					if (state->in_use.load() && state->blocked_on.load(std::memory_order_acquire)) {
+						const auto since = state->blocked_since.load();
+						if (now - since >= stall.count() && reported[state] != since) {
+							reported[state] = since;
+							stalled = true;
+						}
+					}
+				if (stalled)
+					dump();
 			}
-			cond(cond&& rhs) :monitor_mutex(rhs.monitor_mutex) {}
-			/**
-			 *  Blocks the current process until the condition variable is woken up.
-			 *  @param uint priority Set blocked process' priority in internal blocked queue. Smaller number => higher priority.
-			 */
-			void wait(uint priority = 0) {
+		}
+#endif
+	public:
+		template <class Rep, class Period>
+		explicit DeadlockWatchdog(const std::chrono::duration<Rep, Period>& stall)
+#ifdef CHECK_DEADLOCK
+			: stall(std::chrono::duration_cast<std::chrono::steady_clock::duration>(stall)), thread(&DeadlockWatchdog::watch, this) {}
+#else
+		{}
+#endif
+		DeadlockWatchdog(const DeadlockWatchdog&) = delete;
+		DeadlockWatchdog& operator=(const DeadlockWatchdog&) = delete;
+		~DeadlockWatchdog() {
+#ifdef CHECK_DEADLOCK
+			{
 				std::unique_lock<std::mutex> lock(mutex);
-				node_t* node = new node_t(priority);
-				thq.push(node);
-				//TODO: discuss whether to add check for nullptr in case user creates bare monitorable object and calls wait on cv
-				monitor_mutex->unlock();
-				lock.unlock();
-#ifdef DEBUG_COND
-				auto descriptor = Thread::get_descriptor(std::this_thread::get_id());
-				DEBUG_WRITE("condition %s", "blocked thread[#%d] %s", name, descriptor.id, descriptor.name);
+				stopping = true;
+			}
+			wakeup.notify_one();
+			thread.join();
 #endif
-				node->sem->wait();
-#ifdef DEBUG_COND
-				DEBUG_WRITE("condition %s", "released thread[#%d] %s", name, descriptor.id, descriptor.name);
+		}
+		/**
+		 * Writes all currently blocked threads to DEBUG_STREAM right away
+		 */
+		static void dump() {
+#ifdef CHECK_DEADLOCK
+			impl::lock_checker_t::dump();
 #endif
-				delete node;
-				monitor_mutex->lock();
+		}
+	};
+
+	namespace impl {
+		/**
+		 * Unit of work executed by ThreadPool
+		 */
+		struct task_t {
+			virtual void run() = 0;
+			virtual ~task_t() {}
+		};
+		template <class F>
+		struct fn_task_t : public task_t {
+			F fn;
+			fn_task_t(F&& fn) :fn(std::move(fn)) {}
+			void run() override { fn(); }
+		};
+		template <class F>
+		task_t* make_task(F&& fn) {
+			return new fn_task_t<typename std::decay<F>::type>(std::forward<F>(fn));
+		}
+
+		/**
+		 * Chase-Lev work stealing deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+		 * Owner pushes and pops at the bottom without locking, thieves take from the top.
+		 * Outgrown buffers are kept until the deque dies as thieves may still read from them.
+		 */
+		class work_deque_t {
+			struct buffer_t {
+				const std::int64_t capacity;
+				std::unique_ptr<std::atomic<task_t*>[]> items;
+
+				buffer_t(std::int64_t capacity) :capacity(capacity), items(new std::atomic<task_t*>[capacity]) {}
+				task_t* get(std::int64_t i) const {
+					return items[i & (capacity - 1)].load(std::memory_order_relaxed);
+				}
+				void put(std::int64_t i, task_t* task) {
+					items[i & (capacity - 1)].store(task, std::memory_order_relaxed);
+				}
+			};
+
+			CachePadded<std::atomic<std::int64_t>> top{ 0 }; //written by thieves
+			std::atomic<std::int64_t> bottom{ 0 }; //written by owner
+			std::atomic<buffer_t*> buffer;
+			std::vector<std::unique_ptr<buffer_t>> buffers; //current and retired buffers, touched only by owner
+
+			buffer_t* grow(buffer_t* old, std::int64_t t, std::int64_t b) {
+				buffers.emplace_back(new buffer_t(old->capacity * 2));
+				buffer_t* bigger = buffers.back().get();
+				for (std::int64_t i = t; i < b; i++)
+					bigger->put(i, old->get(i));
+				buffer.store(bigger, std::memory_order_release);
+				return bigger;
 			}
-			/**
-			 * Unblock process with the highest priority from blocked queue
-			 * Smaller number => higher priority.
-			 */
-			void signal() {
-				std::unique_lock<std::mutex> lock(mutex);
-				if (!thq.empty()) {
-					thq.top()->sem->signal();
-					thq.pop();
+		public:
+			work_deque_t(std::int64_t capacity = 256) {
+				buffers.emplace_back(new buffer_t(capacity));
+				buffer.store(buffers.back().get());
+			}
+			//owner only
+			void push(task_t* task) {
+				std::int64_t b = bottom.load(std::memory_order_relaxed);
+				std::int64_t t = top->load(std::memory_order_acquire);
+				buffer_t* a = buffer.load(std::memory_order_relaxed);
+				if (b - t > a->capacity - 1)
+					a = grow(a, t, b);
+				a->put(b, task);
+				std::atomic_thread_fence(std::memory_order_release);
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+			//owner only, nullptr if empty
+			task_t* pop() {
+				std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+				buffer_t* a = buffer.load(std::memory_order_relaxed);
+				bottom.store(b, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				std::int64_t t = top->load(std::memory_order_relaxed);
+				if (t > b) {
+					bottom.store(b + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+				task_t* task = a->get(b);
+				if (t == b) {
+					//last item, race against thieves
+					if (!top->compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+						task = nullptr;
+					bottom.store(b + 1, std::memory_order_relaxed);
 				}
+				return task;
+			}
+			//any thread, nullptr if empty or lost the race
+			task_t* steal() {
+				std::int64_t t = top->load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				std::int64_t b = bottom.load(std::memory_order_acquire);
+				if (t >= b)
+					return nullptr;
+				task_t* task = buffer.load(std::memory_order_acquire)->get(t);
+				if (!top->compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					return nullptr;
+				return task;
+			}
+			bool empty() const {
+				return top->load() >= bottom.load();
+			}
+		};
+	}
+
+	/**
+	 * Fixed set of worker threads that execute submitted tasks. Each worker keeps its own
+	 * deque of tasks, tasks submitted from a worker go to its deque and idle workers steal
+	 * from others, tasks submitted from outside go through a shared injection queue.
+	 * Tasks should not block for long, as a blocked task holds on to its worker.
+	 */
+	class ThreadPool {
+		struct worker_t {
+			ThreadPool* pool;
+			std::size_t index;
+			impl::work_deque_t deque;
+			std::thread thread;
+			unsigned random_state;
 
+			worker_t(ThreadPool* pool, std::size_t index) :pool(pool), index(index), random_state(static_cast<unsigned>(index) * 2654435761u + 1) {}
+			std::size_t random_victim() {
+				random_state ^= random_state << 13;
+				random_state ^= random_state >> 17;
+				random_state ^= random_state << 5;
+				return random_state % pool->workers.size();
 			}
-			/**
-			 * Unblock all processes from blocked queue
-			 */
-			void signalAll() {
-				std::unique_lock<std::mutex> lock(mutex);
-				while (!thq.empty()) {
-					thq.top()->sem->signal();
-					thq.pop();
+		};
+
+		std::vector<std::unique_ptr<worker_t>> workers;
+		mutex_t injection_mutex;
+		std::deque<impl::task_t*> injection;
+		CachePadded<std::atomic<int>> injected{ 0 }; //padding keeps epoch off the lines submitters write
+		//idle workers park on epoch, which changes whenever new work shows up
+		std::atomic<int> epoch{ 0 };
+		std::atomic<int> sleepers{ 0 };
+		std::atomic<bool> stopping{ false };
+		ShardedCounter executed, stolen, parked;
+
+		static worker_t*& current_worker() {
+			static thread_local worker_t* worker = nullptr;
+			return worker;
+		}
+		void notify() {
+			epoch.fetch_add(1);
+			if (sleepers.load() > 0)
+				impl::futex_wake(&epoch, 1);
+		}
+		void schedule(impl::task_t* task) {
+			worker_t* worker = current_worker();
+			if (worker && worker->pool == this)
+				worker->deque.push(task);
+			else {
+				std::unique_lock<mutex_t> lock(injection_mutex);
+				injection.push_back(task);
+				injected->fetch_add(1);
+			}
+			notify();
+		}
+		impl::task_t* take_injected() {
+			if (injected->load() == 0)
+				return nullptr;
+			std::unique_lock<mutex_t> lock(injection_mutex);
+			if (injection.empty())
+				return nullptr;
+			impl::task_t* task = injection.front();
+			injection.pop_front();
+			injected->fetch_sub(1);
+			return task;
+		}
+		impl::task_t* find_task(worker_t& self) {
+			impl::task_t* task = self.deque.pop();
+			if (!task)
+				task = take_injected();
+			for (std::size_t i = 0, start = self.random_victim(); !task && i < workers.size(); i++) {
+				worker_t& victim = *workers[(start + i) % workers.size()];
+				if (&victim != &self && (task = victim.deque.steal()))
+					++stolen;
+			}
+			return task;
+		}
+		bool has_work() {
+			if (injected->load() > 0)
+				return true;
+			for (auto& worker : workers)
+				if (!worker->deque.empty())
+					return true;
+			return false;
+		}
+		static void run_task(impl::task_t* task) {
+			task->run();
+			delete task;
+		}
+		void work(worker_t& self) {
+			current_worker() = &self;
+#ifdef DEBUG_POOL
+			DEBUG_WRITE("pool worker[#%d]", "started", static_cast<int>(self.index));
+#endif
+			while (true) {
+				const int seen = epoch.load();
+				if (impl::task_t* task = find_task(self)) {
+					run_task(task);
+					++executed;
+					continue;
 				}
+				//steal can fail on contention, so look once more at the queues before sleeping
+				if (has_work())
+					continue;
+				if (stopping.load())
+					break;
+				sleepers.fetch_add(1);
+				++parked;
+				impl::futex_wait(&epoch, seen);
+				sleepers.fetch_sub(1);
 			}
-			/**
-			 * Check whether blocked queue is empty
-			 * @return bool
-			 */
-			bool empty() {
-				std::unique_lock<std::mutex> lock(mutex);
-				return thq.empty();
+#ifdef DEBUG_POOL
+			DEBUG_WRITE("pool worker[#%d]", "stopped", static_cast<int>(self.index));
+#endif
+			current_worker() = nullptr;
+		}
+
+		//shared by caller and helper tasks of parallel_for, outlives the call if helpers start late
+		struct loop_state_t {
+			std::atomic<long> next;
+			const long end;
+			const long grain;
+			std::atomic<int> active{ 0 }; //helpers currently inside the loop
+			std::atomic<bool> failed{ false };
+			std::exception_ptr error;
+
+			loop_state_t(long begin, long end, long grain) :next(begin), end(end), grain(grain) {}
+			template <class F>
+			void run(F& fn) {
+				try {
+					for (long i; (i = next.fetch_add(grain)) < end;)
+						for (long last = std::min(i + grain, end); i < last; i++)
+							fn(i);
+				}
+				catch (...) {
+					if (!failed.exchange(true))
+						error = std::current_exception();
+					next.store(end); //others stop after their current chunk
+				}
+			}
+			template <class F>
+			void help(F& fn) {
+				active.fetch_add(1);
+				run(fn); //does nothing if caller already finished, fn is not touched then
+				if (active.fetch_sub(1) == 1)
+					impl::futex_wake(&active, INT_MAX);
+			}
+			void wait_helpers() {
+				for (int n; (n = active.load()) != 0;)
+					impl::futex_wait(&active, n);
+			}
+		};
+	public:
+		/**
+		 * @param std::size_t size Number of worker threads, defaults to number of hardware threads
+		 */
+		ThreadPool(std::size_t size = std::thread::hardware_concurrency()) {
+			size = std::max<std::size_t>(size, 1);
+			for (std::size_t i = 0; i < size; i++)
+				workers.emplace_back(new worker_t(this, i));
+			for (auto& worker : workers) {
+				worker_t* self = worker.get();
+				worker->thread = std::thread([this, self] { work(*self); });
+			}
+		}
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		/**
+		 * Finishes all tasks submitted so far and joins the workers
+		 */
+		~ThreadPool() {
+			stopping.store(true);
+			epoch.fetch_add(1);
+			impl::futex_wake(&epoch, INT_MAX);
+			for (auto& worker : workers)
+				worker->thread.join();
+		}
+		std::size_t size() const {
+			return workers.size();
+		}
+		struct stats_t {
+			std::int64_t executed; //tasks run by workers, chunks parallel_for runs on the calling thread excluded
+			std::int64_t stolen;   //tasks taken from another worker's deque
+			std::int64_t parked;   //times a worker went to sleep for lack of work
+		};
+		stats_t stats() const {
+			return { executed.value(), stolen.value(), parked.value() };
+		}
+		/**
+		 * Schedules fn(args...) for execution on the pool
+		 * @return std::future Result of the call, or exception it has thrown
+		 */
+		template <class F, class... Args>
+		std::future<typename std::result_of<F(Args...)>::type> submit(F&& fn, Args&&... args) {
+			typedef typename std::result_of<F(Args...)>::type result_t;
+			std::packaged_task<result_t()> task(std::bind(std::forward<F>(fn), std::forward<Args>(args)...));
+			std::future<result_t> result = task.get_future();
+			schedule(impl::make_task(std::move(task)));
+			return result;
+		}
+		/**
+		 * Calls fn(i) for each i in [begin, end), in chunks of grain indices spread over the workers.
+		 * Calling thread works on the loop too and returns when all indices are done.
+		 * Rethrows the first exception thrown by fn, remaining chunks are then skipped.
+		 * @param long grain Indices per chunk, 0 picks one that gives each worker a few chunks
+		 */
+		template <class F>
+		void parallel_for(long begin, long end, F&& fn, long grain = 0) {
+			if (begin >= end)
+				return;
+			if (grain <= 0)
+				grain = std::max<long>(1, (end - begin) / static_cast<long>(4 * workers.size()));
+			auto state = std::make_shared<loop_state_t>(begin, end, grain);
+			const long chunks = (end - begin + grain - 1) / grain;
+			const long helpers = std::min<long>(chunks - 1, static_cast<long>(workers.size()));
+			for (long i = 0; i < helpers; i++)
+				schedule(impl::make_task([state, &fn] { state->help(fn); }));
+			state->run(fn);
+			state->wait_helpers();
+			if (state->failed.load())
+				std::rethrow_exception(state->error);
+		}
+		/**
+		 * Schedules fn() for execution on the pool, makes ThreadPool usable as executor of Future::then
+		 */
+		template <class F>
+		void execute(F&& fn) {
+			schedule(impl::make_task(std::forward<F>(fn)));
+		}
+		/**
+		 * Same as submit but returns Future, which can be chained without blocking a thread
+		 */
+		template <class F, class... Args>
+		Future<typename std::result_of<F(Args...)>::type> async(F&& fn, Args&&... args) {
+			typedef typename std::result_of<F(Args...)>::type result_t;
+			Promise<result_t> promise;
+			Future<result_t> result = promise.get_future();
+			auto call = std::bind(std::forward<F>(fn), std::forward<Args>(args)...);
+			execute([promise = std::move(promise), call = std::move(call)]() mutable {
+				impl::fulfil_t<result_t>::call(promise, call);
+			});
+			return result;
+		}
+		/**
+		 * Runs thread's run() as a pool task instead of on its own std::thread.
+		 * Thread must not be started, and result replaces join().
+		 */
+		std::future<void> launch(Thread& thread) {
+			return submit([&thread] { thread.execute(); });
+		}
+	};
+
+	/**
+	 * Runs callbacks at given times from a single thread, keeping pending timers in a
+	 * hierarchical timing wheel with tick of 100us. Each pending timer costs one wheel entry,
+	 * so timeouts don't need a sleeping thread each. Callbacks run on the service thread
+	 * one after another and should be short, longer work belongs to a ThreadPool.
+	 */
+	class TimerService {
+		typedef std::chrono::steady_clock::time_point time_point_t;
+		typedef std::chrono::steady_clock::duration duration_t;
+		typedef std::uint64_t tick_t;
+
+		static constexpr int levels = 4;
+		static constexpr int slot_bits = 8; //each level covers 256 times the span of the one below
+		static constexpr tick_t slot_mask = (1 << slot_bits) - 1;
+		static constexpr tick_t max_delta = (tick_t(1) << (levels * slot_bits)) - 1;
+
+		struct entry_t {
+			std::function<void()> fn;
+			time_point_t when;
+			duration_t period; //zero for one-shot timers
+			tick_t expires = 0;
+			entry_t* prev = nullptr;
+			entry_t* next = nullptr;
+			entry_t** slot = nullptr; //list entry is linked in, null when not pending
+			std::shared_ptr<entry_t> self; //wheel's reference to the pending entry
+			bool cancelled = false;
+
+			entry_t(std::function<void()>&& fn, const time_point_t& when, const duration_t& period) :fn(std::move(fn)), when(when), period(period) {}
+		};
+
+		const time_point_t origin = std::chrono::steady_clock::now();
+		entry_t* wheel[levels][slot_mask + 1] = {};
+		tick_t current = 0; //next tick to be processed
+		tick_t planned = 0; //tick service thread sleeps until, 0 while it's awake
+		std::size_t count = 0;
+		std::mutex mutex; //not a Mutex, fibers add their timeouts while already parked
+		std::atomic<int> wakeups{ 0 };
+		bool stopping = false;
+		std::thread thread;
+
+		static tick_t ticks(const duration_t& duration) {
+			return static_cast<tick_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / 100);
+		}
+		//first tick at or after when
+		tick_t tick_of(const time_point_t& when) const {
+			if (when <= origin)
+				return 0;
+			const tick_t tick = ticks(when - origin);
+			return origin + std::chrono::microseconds(tick * 100) < when ? tick + 1 : tick;
+		}
+		time_point_t time_of(tick_t tick) const {
+			return origin + std::chrono::microseconds(tick * 100);
+		}
+		void link(entry_t* entry) {
+			tick_t expires = std::max(entry->expires, current);
+			tick_t delta = expires - current;
+			if (delta > max_delta)
+				expires = current + (delta = max_delta); //cascades down again until it's due
+			int level = 0;
+			while (level < levels - 1 && delta >> ((level + 1) * slot_bits))
+				level++;
+			entry->slot = &wheel[level][(expires >> (level * slot_bits)) & slot_mask];
+			entry->prev = nullptr;
+			entry->next = *entry->slot;
+			if (entry->next)
+				entry->next->prev = entry;
+			*entry->slot = entry;
+			count++;
+		}
+		void unlink(entry_t* entry) {
+			if (entry->prev)
+				entry->prev->next = entry->next;
+			else
+				*entry->slot = entry->next;
+			if (entry->next)
+				entry->next->prev = entry->prev;
+			entry->slot = nullptr;
+			count--;
+		}
+		//moves entries of slot one level down, returns slot's index
+		tick_t cascade(int level) {
+			const tick_t index = (current >> (level * slot_bits)) & slot_mask;
+			entry_t* entry = wheel[level][index];
+			wheel[level][index] = nullptr;
+			while (entry) {
+				entry_t* next = entry->next;
+				count--;
+				link(entry);
+				entry = next;
+			}
+			return index;
+		}
+		//processes ticks up to now, collecting entries that are due
+		void advance(tick_t now, std::vector<std::shared_ptr<entry_t>>& due) {
+			while (current <= now) {
+				const tick_t index = current & slot_mask;
+				for (int level = 1; level < levels && (current >> ((level - 1) * slot_bits) & slot_mask) == 0; level++)
+					if (cascade(level) != 0)
+						break;
+				while (entry_t* entry = wheel[0][index]) {
+					unlink(entry);
+					due.push_back(std::move(entry->self));
+				}
+				current++;
+			}
+		}
+		//first tick at which an entry is due or has to be cascaded down
+		tick_t next_event() const {
+			tick_t next = std::numeric_limits<tick_t>::max();
+			for (int level = 0; level < levels; level++) {
+				const int shift = level * slot_bits;
+				const tick_t first = (current + (tick_t(1) << shift) - 1) >> shift; //first slot not cascaded yet
+				for (tick_t block = first; block <= first + slot_mask; block++)
+					if (wheel[level][block & slot_mask]) {
+						next = std::min(next, block << shift);
+						break;
+					}
 			}
+			return next;
+		}
+		void run() {
+			std::vector<std::shared_ptr<entry_t>> due;
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping) {
+				advance(ticks(std::chrono::steady_clock::now() - origin), due);
+				if (!due.empty()) {
+					lock.unlock();
+					for (auto& entry : due)
+						entry->fn();
+					lock.lock();
+					for (auto& entry : due)
+						if (entry->period != duration_t::zero() && !entry->cancelled) {
+							const time_point_t now = std::chrono::steady_clock::now();
+							do
+								entry->when += entry->period; //skip periods missed while callbacks were running
+							while (entry->when <= now);
+							entry->expires = tick_of(entry->when);
+							entry_t* rearmed = entry.get();
+							rearmed->self = std::move(entry);
+							link(rearmed);
+						}
+					due.clear();
+					continue;
+				}
+				const int seen = wakeups.load();
+				const bool idle = count == 0;
+				planned = idle ? std::numeric_limits<tick_t>::max() : next_event();
+				const time_point_t deadline = idle ? time_point_t::max() : time_of(planned);
+				lock.unlock();
+#ifdef DEBUG_TIMER
+				DEBUG_WRITE("timer service", "sleeping");
+#endif
+				if (idle)
+					impl::futex_wait(&wakeups, seen);
+				else
+					impl::futex_wait_until(&wakeups, seen, deadline);
+				lock.lock();
+				planned = 0;
+			}
+		}
+	public:
+		/**
+		 * Handle of scheduled timer, default constructed handle refers to no timer
+		 */
+		class timer {
+			TimerService* service = nullptr;
+			std::weak_ptr<entry_t> entry;
+		public:
+			timer() = default;
+			timer(TimerService* service, const std::shared_ptr<entry_t>& entry) :service(service), entry(entry) {}
 			/**
-			 *  Check if there are processes in blocked queue
-			 * @return bool
+			 * Stops the timer. Callback that is already running finishes, but isn't run again.
+			 * @return bool false if the timer has already fired, was cancelled or refers to no timer
 			 */
-			bool queue() {
-				std::unique_lock<std::mutex> lock(mutex);
-				return !thq.empty();
+			bool cancel() {
+				std::shared_ptr<entry_t> e = entry.lock();
+				if (!e)
+					return false;
+				std::unique_lock<std::mutex> lock(service->mutex);
+				if (e->cancelled)
+					return false;
+				e->cancelled = true;
+				if (e->slot) {
+					service->unlink(e.get());
+					e->self.reset();
+					return true;
+				}
+				return e->period != duration_t::zero(); //periodic timer running right now
 			}
 			/**
-			 * Get the priority of the next process to be unblocked from queue.
-			 * If queue is empty returns MAXUINT
-			 * @return uint
+			 * @return bool true if callback is going to be run (again)
 			 */
-			uint minrank() {
+			bool pending() const {
+				std::shared_ptr<entry_t> e = entry.lock();
+				if (!e)
+					return false;
+				std::unique_lock<std::mutex> lock(service->mutex);
+				return !e->cancelled && (e->slot || e->period != duration_t::zero());
+			}
+		};
+
+		TimerService() {
+			thread = std::thread([this] { run(); });
+		}
+		TimerService(const TimerService&) = delete;
+		TimerService& operator=(const TimerService&) = delete;
+		/**
+		 * Stops the service thread, timers that are still pending never fire
+		 */
+		~TimerService() {
+			{
 				std::unique_lock<std::mutex> lock(mutex);
-				return thq.empty() ? -1 : thq.top()->rank;
+				stopping = true;
+			}
+			wakeups.fetch_add(1);
+			impl::futex_wake(&wakeups, 1);
+			thread.join();
+			for (auto& level : wheel)
+				for (entry_t*& slot : level)
+					while (entry_t* entry = slot) {
+						unlink(entry);
+						entry->self.reset();
+					}
+		}
+		/**
+		 * Service shared by the whole process, started on first use
+		 */
+		static TimerService& global() {
+			static TimerService service;
+			return service;
+		}
+		/**
+		 * Runs fn() on the service thread at time when, or as soon as possible if it has passed.
+		 * When period is not zero fn() is run again every period after that.
+		 */
+		timer schedule_at(const time_point_t& when, std::function<void()> fn, const duration_t& period = duration_t::zero()) {
+			auto entry = std::make_shared<entry_t>(std::move(fn), when, period);
+			std::unique_lock<std::mutex> lock(mutex);
+			entry->expires = tick_of(when);
+			entry->self = entry;
+			link(entry.get());
+			if (entry->expires < planned) {
+				//service thread sleeps past this timer
+				planned = entry->expires;
+				wakeups.fetch_add(1);
+				impl::futex_wake(&wakeups, 1);
+			}
+			return timer(this, entry);
+		}
+		/**
+		 * Runs fn() on the service thread once delay passes
+		 */
+		template <class Rep, class Period>
+		timer schedule_after(const std::chrono::duration<Rep, Period>& delay, std::function<void()> fn) {
+			return schedule_at(std::chrono::steady_clock::now() + std::chrono::duration_cast<duration_t>(delay), std::move(fn));
+		}
+		/**
+		 * Runs fn() on the service thread every period, first time after one period
+		 */
+		template <class Rep, class Period>
+		timer schedule_every(const std::chrono::duration<Rep, Period>& period, std::function<void()> fn) {
+			const duration_t every = std::chrono::duration_cast<duration_t>(period);
+			return schedule_at(std::chrono::steady_clock::now() + every, std::move(fn), every);
+		}
+		/**
+		 * @return std::size_t Number of timers waiting in the wheel
+		 */
+		std::size_t pending() {
+			std::unique_lock<std::mutex> lock(mutex);
+			return count;
+		}
+	};
+
+#ifdef __linux__
+	namespace impl {
+		struct fiber_t {
+			enum state_t { READY, RUNNING, PARKING, PARKED, NOTIFIED, DONE };
+
+			ucontext_t context;
+			ucontext_t* resumer = nullptr; //context of the worker that runs the fiber
+			char* stack = nullptr; //mapping that holds guard page and stack, if any
+			std::size_t mapped = 0;
+			std::unique_ptr<task_t> body;
+			FiberScheduler* scheduler;
+			const std::size_t index = slot_counter()++;
+			std::atomic<int> state{ READY };
+			Thread::record_t* record = nullptr; //registry entry of Thread the fiber runs
+			//parking, guarded by bucket of wait_addr
+			std::atomic<int>* wait_addr = nullptr;
+			fiber_t* wait_prev = nullptr;
+			fiber_t* wait_next = nullptr;
+			std::uint64_t wait_seq = 0;
+			bool timed_out = false;
+
+			fiber_t(FiberScheduler* scheduler, task_t* body) :body(body), scheduler(scheduler) {}
+			~fiber_t() {
+				if (stack)
+					munmap(stack, mapped);
+			}
+			//switches back to the worker, which decides what happens with the fiber by its state
+			void suspend() {
+				swapcontext(&context, resumer);
+			}
+			//worker side of switching, makes fiber's registry entry current while it runs
+			void switch_in(ucontext_t* worker) {
+				resumer = worker;
+				Thread::record_t* saved = Thread::current_record();
+				Thread::current_record() = record;
+				current_fiber() = this;
+				swapcontext(worker, &context);
+				current_fiber() = nullptr;
+				record = Thread::current_record();
+				Thread::current_record() = saved;
+			}
+		};
+
+		//fibers parked on futex words, hashed by address
+		struct fiber_bucket_t {
+			std::mutex mutex;
+			fiber_t* head = nullptr;
+
+			void link(fiber_t* fiber) {
+				fiber->wait_prev = nullptr;
+				fiber->wait_next = head;
+				if (head)
+					head->wait_prev = fiber;
+				head = fiber;
+			}
+			void unlink(fiber_t* fiber) {
+				if (fiber->wait_prev)
+					fiber->wait_prev->wait_next = fiber->wait_next;
+				else
+					head = fiber->wait_next;
+				if (fiber->wait_next)
+					fiber->wait_next->wait_prev = fiber->wait_prev;
+				fiber->wait_addr = nullptr;
 			}
 		};
+		inline fiber_bucket_t& fiber_bucket(const void* addr) {
+			static CachePadded<fiber_bucket_t> buckets[256];
+			//multiplicative hash, words on fiber stacks lie at the same offset of equally sized stacks
+			return *buckets[(static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(addr)) * 0x9E3779B97F4A7C15ull) >> 56];
+		}
+		//lets futex_wake skip the buckets while no fiber is parked anywhere
+		inline std::atomic<int>& parked_fibers() {
+			static std::atomic<int> count{ 0 };
+			return count;
+		}
+	}
+
+	/**
+	 * Runs functions and Thread bodies as fibers, each with its own small stack, on a few
+	 * worker threads (M:N threading). Waiting in library primitives - Semaphore, Mutex,
+	 * Monitor conds, MessageBox, Channel, Future, Thread::sleep_for - suspends only the
+	 * fiber and its worker goes on with another one. Blocking outside of them, e.g. on
+	 * std::mutex or in system calls, blocks the worker. Linux only.
+	 */
+	class FiberScheduler {
+		std::size_t stack_size;
+		bool guard_pages;
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable work_available, all_done;
+		std::deque<impl::fiber_t*> ready;
+		std::size_t live = 0; //fibers that haven't finished
+		std::size_t idle = 0; //workers waiting for work
+		bool stopping = false;
+
+		friend inline bool impl::fiber_wait(std::atomic<int>* addr, int expected, const impl::deadline_t* deadline);
+		friend inline void impl::fiber_wake(std::atomic<int>* addr, int count);
+
+		static void entry() {
+			impl::fiber_t* self = impl::current_fiber();
+			self->body->run();
+			self->state.store(impl::fiber_t::DONE);
+			self->suspend();
+		}
+		//maps fiber's stack rounded up to pages, below it an inaccessible page when guarded
+		void map_stack(impl::fiber_t* fiber) {
+			static const std::size_t page = static_cast<std::size_t>(getauxval(AT_PAGESZ));
+			const std::size_t guard = guard_pages ? page : 0;
+			const std::size_t length = (stack_size + page - 1) / page * page + guard;
+			void* addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+			if (addr == MAP_FAILED)
+				throw std::system_error(errno, std::generic_category(), "FiberScheduler::spawn");
+			fiber->stack = static_cast<char*>(addr);
+			fiber->mapped = length;
+			if (guard && mprotect(addr, guard, PROT_NONE) != 0)
+				throw std::system_error(errno, std::generic_category(), "FiberScheduler::spawn");
+			fiber->context.uc_stack.ss_sp = fiber->stack + guard;
+			fiber->context.uc_stack.ss_size = length - guard;
+		}
+		void enqueue(impl::fiber_t* fiber) {
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.push_back(fiber);
+			if (idle)
+				work_available.notify_one();
+		}
+		//makes parked fiber runnable, or tells the worker still switching away from it to requeue it
+		static void resume(impl::fiber_t* fiber) {
+			int state = fiber->state.load();
+			while (state == impl::fiber_t::PARKING || state == impl::fiber_t::PARKED) {
+				if (state == impl::fiber_t::PARKING && fiber->state.compare_exchange_weak(state, impl::fiber_t::NOTIFIED))
+					return;
+				if (state == impl::fiber_t::PARKED && fiber->state.compare_exchange_weak(state, impl::fiber_t::READY)) {
+					fiber->scheduler->enqueue(fiber);
+					return;
+				}
+			}
+		}
+		void run(impl::fiber_t* fiber, ucontext_t* worker) {
+			fiber->state.store(impl::fiber_t::RUNNING);
+			fiber->switch_in(worker);
+			int state = fiber->state.load();
+			if (state == impl::fiber_t::DONE) {
+				delete fiber;
+				std::unique_lock<std::mutex> lock(mutex);
+				if (--live == 0)
+					all_done.notify_all();
+				return;
+			}
+			if (state == impl::fiber_t::PARKING && fiber->state.compare_exchange_strong(state, impl::fiber_t::PARKED))
+				return;
+			//yielded, or woken before it was off the worker
+			fiber->state.store(impl::fiber_t::READY);
+			enqueue(fiber);
+		}
+		void work() {
+			ucontext_t context;
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true) {
+				while (ready.empty() && !stopping) {
+					idle++;
+					work_available.wait(lock);
+					idle--;
+				}
+				if (ready.empty())
+					break;
+				impl::fiber_t* fiber = ready.front();
+				ready.pop_front();
+				lock.unlock();
+				run(fiber, &context);
+				lock.lock();
+			}
+		}
+	public:
+		/**
+		 * @param std::size_t stack_size Stack of each fiber, rounded up to whole pages. Stacks are
+		 * mapped memory, so only touched pages take memory
+		 * @param bool guard_pages Puts an inaccessible page below each stack, so overflowing it faults
+		 * instead of overwriting other memory. A guarded stack takes two of the process's memory
+		 * mappings (vm.max_map_count, 65530 by default), turn guards off to have more than about
+		 * 30000 fibers alive at once
+		 */
+		FiberScheduler(std::size_t size = std::max(1u, std::thread::hardware_concurrency()), std::size_t stack_size = 64 * 1024, bool guard_pages = true) :stack_size(stack_size), guard_pages(guard_pages) {
+			for (std::size_t i = 0; i < size; i++)
+				workers.emplace_back([this] { work(); });
+		}
+		FiberScheduler(const FiberScheduler&) = delete;
+		FiberScheduler& operator=(const FiberScheduler&) = delete;
+		/**
+		 * Waits for all fibers to finish and joins the workers
+		 */
+		~FiberScheduler() {
+			std::unique_lock<std::mutex> lock(mutex);
+			all_done.wait(lock, [this] { return live == 0; });
+			stopping = true;
+			work_available.notify_all();
+			lock.unlock();
+			for (auto& worker : workers)
+				worker.join();
+		}
+		std::size_t size() const {
+			return workers.size();
+		}
+		/**
+		 * Runs fn() in a new fiber
+		 * @return Future<void> Ready when fn returns, holds exception it has thrown
+		 * @throws std::system_error when fiber's stack can't be mapped
+		 */
+		template <class F>
+		Future<void> spawn(F&& fn) {
+			Promise<void> promise;
+			Future<void> result = promise.get_future();
+			std::unique_ptr<impl::fiber_t> fiber(new impl::fiber_t(this, impl::make_task([promise = std::move(promise), fn = typename std::decay<F>::type(std::forward<F>(fn))]() mutable {
+				impl::fulfil_t<void>::call(promise, fn);
+			})));
+			getcontext(&fiber->context);
+			map_stack(fiber.get());
+			fiber->context.uc_link = nullptr;
+			makecontext(&fiber->context, &FiberScheduler::entry, 0);
+			std::unique_lock<std::mutex> lock(mutex);
+			live++;
+			ready.push_back(fiber.release());
+			if (idle)
+				work_available.notify_one();
+			return result;
+		}
+		/**
+		 * Runs thread's run() as a fiber instead of on its own std::thread.
+		 * Thread must not be started, and result replaces join().
+		 */
+		Future<void> launch(Thread& thread) {
+			thread.reset_finished();
+			return spawn([&thread] { thread.execute(); });
+		}
+		/**
+		 * Lets other fibers run on the worker, on plain threads it is std::this_thread::yield
+		 */
+		static void yield() {
+			impl::fiber_t* self = impl::current_fiber();
+			if (!self) {
+				std::this_thread::yield();
+				return;
+			}
+			self->state.store(impl::fiber_t::READY);
+			self->suspend();
+		}
+		/**
+		 * @return bool true if called from a fiber
+		 */
+		static bool in_fiber() {
+			return impl::current_fiber() != nullptr;
+		}
+	};
+
+	namespace impl {
+		inline std::size_t fiber_index(const fiber_t* fiber) {
+			return fiber->index;
+		}
+		inline bool fiber_wait(std::atomic<int>* addr, int expected, const deadline_t* deadline) {
+			fiber_t* self = current_fiber();
+			fiber_bucket_t& bucket = fiber_bucket(addr);
+			std::uint64_t seq;
+			{
+				std::unique_lock<std::mutex> lock(bucket.mutex);
+				parked_fibers().fetch_add(1);
+				if (addr->load() != expected) {
+					parked_fibers().fetch_sub(1);
+					return true;
+				}
+				self->wait_addr = addr;
+				self->timed_out = false;
+				seq = ++self->wait_seq;
+				bucket.link(self);
+				self->state.store(fiber_t::PARKING);
+			}
+			TimerService::timer timeout;
+			if (deadline)
+				timeout = TimerService::global().schedule_at(*deadline, [self, seq, addr] {
+					fiber_bucket_t& bucket = fiber_bucket(addr);
+					{
+						std::unique_lock<std::mutex> lock(bucket.mutex);
+						fiber_t* fiber = bucket.head;
+						while (fiber && fiber != self)
+							fiber = fiber->wait_next;
+						if (!fiber || fiber->wait_addr != addr || fiber->wait_seq != seq)
+							return; //woken already
+						bucket.unlink(fiber);
+						fiber->timed_out = true;
+						parked_fibers().fetch_sub(1);
+					}
+					FiberScheduler::resume(self);
+				});
+			self->suspend();
+			if (deadline)
+				timeout.cancel();
+			return !self->timed_out;
+		}
+		inline void fiber_wake(std::atomic<int>* addr, int count) {
+			std::atomic_thread_fence(std::memory_order_seq_cst); //orders waker's store before the check, pairs with parked_fibers increment
+			if (parked_fibers().load(std::memory_order_relaxed) == 0)
+				return;
+			fiber_t* woken = nullptr;
+			fiber_bucket_t& bucket = fiber_bucket(addr);
+			{
+				std::unique_lock<std::mutex> lock(bucket.mutex);
+				for (fiber_t* fiber = bucket.head; fiber && count > 0;) {
+					fiber_t* next = fiber->wait_next;
+					if (fiber->wait_addr == addr) {
+						bucket.unlink(fiber);
+						parked_fibers().fetch_sub(1);
+						fiber->wait_next = woken;
+						woken = fiber;
+						count--;
+					}
+					fiber = next;
+				}
+			}
+			while (fiber_t* fiber = woken) {
+				woken = fiber->wait_next;
+				FiberScheduler::resume(fiber);
+			}
+		}
+	}
+#endif
+
+	typedef unsigned int uint;
+
+	template <class T>
+	class Monitor;
+	template <class T>
+	class SharedMonitor;
+	template <class T>
+	class CombiningMonitor;
+
+	namespace impl {
+		/**
+		 * Thread parked inside a monitor until the monitor lock is handed over to it.
+		 * Lives on the parked thread's stack.
+		 */
+		struct monitor_waiter_t {
+			enum state_t {
+				WAITING,   //blocked on cond
+				SIGNALED,  //released from cond, queued for the lock
+				OWNER,     //lock handed over, thread may proceed
+				CANCELLED, //timed out before it was signalled
+				DROPPED    //cancelled and already taken out of cond queue by signal
+			};
+			std::atomic<int> state{ WAITING }; //futex word the thread parks on
+			monitor_waiter_t* next_owner = nullptr; //next in queue for the lock
+
+			void park() {
+				for (int s; (s = state.load()) != OWNER;)
+					futex_wait(&state, s);
+			}
+			//@return bool false if deadline passed while still WAITING
+			bool park_until(const deadline_t& deadline) {
+				for (int s; (s = state.load()) != OWNER;)
+					if (!futex_wait_until(&state, s, deadline) && state.load() == WAITING)
+						return false;
+				return true;
+			}
+			//new owner may return and free its node before wake is issued, which is harmless
+			//as futex_wake on a stale address causes at most a spurious wakeup
+			void hand_over() {
+				state.store(OWNER);
+				futex_wake(&state, 1);
+			}
+		};
+
+		/**
+		 * Exclusive lock of a monitor together with its queues of threads that get the
+		 * lock directly from the releasing thread, without unlocking and competing for it.
+		 * Urgent are Hoare signallers waiting for signalled thread to leave, handoff are
+		 * signalled Mesa waiters in signal order. Queues are guarded by the lock itself.
+		 * Lets monitors with different locking protocols share the same cond implementation.
+		 */
+		struct monitor_lock_t {
+			monitor_waiter_t* urgent = nullptr; //stack, most recent signaller resumes first
+			monitor_waiter_t* handoff_head = nullptr;
+			monitor_waiter_t* handoff_tail = nullptr;
+
+			virtual void acquire() = 0;
+			virtual void release() = 0;
+#ifdef CHECK_DEADLOCK
+			//lock as known to the lock order checker
+			virtual const void* identity() const = 0;
+#endif
+			virtual ~monitor_lock_t() {}
+
+			void lock() {
+				acquire();
+			}
+			//passes the lock to the next urgent or handoff thread if there is one, otherwise releases it
+			void unlock() {
+				monitor_waiter_t* next = urgent;
+				if (next)
+					urgent = next->next_owner;
+				else if ((next = handoff_head) != nullptr) {
+					handoff_head = next->next_owner;
+					if (!handoff_head)
+						handoff_tail = nullptr;
+				}
+				if (next) {
+#ifdef CHECK_DEADLOCK
+					lock_checker_t::released(identity());
+#endif
+					next->hand_over();
+				}
+				else
+					release();
+			}
+			void push_handoff(monitor_waiter_t* waiter) {
+				waiter->next_owner = nullptr;
+				(handoff_tail ? handoff_tail->next_owner : handoff_head) = waiter;
+				handoff_tail = waiter;
+			}
+			void push_urgent(monitor_waiter_t* waiter) {
+				waiter->next_owner = urgent;
+				urgent = waiter;
+			}
+		};
+#ifdef CHECK_DEADLOCK
+		template <class L>
+		const void* lock_identity(const L& lockable) {
+			return &lockable;
+		}
+#endif
+		template <class L>
+		struct monitor_lock_ref_t : public monitor_lock_t {
+			L& lockable;
+			monitor_lock_ref_t(L& lockable) :lockable(lockable) {}
+			void acquire() override { lockable.lock(); }
+			void release() override { lockable.unlock(); }
+#ifdef CHECK_DEADLOCK
+			const void* identity() const override { return lock_identity(lockable); }
+#endif
+		};
+	}
+
+	/**
+	 * Parent class for all classes that are candidates to become monitor
+	 */
+	class Monitorable {
+	protected:
+		/**
+		 * Order in which cond releases waiters of equal rank. PRIORITY makes no promise
+		 * about it, STABLE releases them in arrival order and queues rank 0 waiters in
+		 * a plain FIFO, so signal on a cond whose waiters all use rank 0 is O(1)
+		 */
+		enum ordering_t { PRIORITY, STABLE };
+		/**
+		 * What signal does with the released waiter. Both hand the monitor lock over to it
+		 * directly, so it never competes with newcomers for the lock. MESA (signal and continue)
+		 * lets signalling thread finish its call first, then passes the lock to released waiters
+		 * in order. HOARE (signal and wait) passes the lock immediately and parks signalling
+		 * thread until released waiter leaves the monitor or waits again, so the waiter sees
+		 * exactly the state in which it was signalled.
+		 */
+		enum signaling_t { MESA, HOARE };
+
+		class cond {
+			/**
+			 * Wait queue entry. It lives on the waiting thread's stack for the duration of wait
+			 * and is linked into the pairing heap of its cond, so waiting allocates nothing.
+			 */
+			struct node_t : public impl::monitor_waiter_t {
+				uint rank;
+				std::uint64_t seq = 0;     //arrival order, used as tie breaker in STABLE ordering
+				node_t* child = nullptr;   //leftmost child in pairing heap
+				node_t* next = nullptr;    //right sibling, or next node in FIFO
+				node_t* prev = nullptr;    //left sibling or parent for leftmost child, or previous node in FIFO
+
+				node_t(uint rank) :rank(rank) {}
+			};
+
+			impl::monitor_lock_t* & monitor_mutex;
+			//root of pairing heap of waiters, smaller rank on top. Guarded by monitor_mutex
+			node_t* root = nullptr;
+			//FIFO of rank 0 waiters in STABLE ordering, they go before everything in the heap
+			node_t* head = nullptr;
+			node_t* tail = nullptr;
+			std::uint64_t next_seq = 0;
+			ordering_t ordering;
+			signaling_t signaling;
+			const char* name;
+
+			static bool before(const node_t* a, const node_t* b) {
+				return a->rank < b->rank || (a->rank == b->rank && a->seq < b->seq);
+			}
+			//links root b under root a or vice versa, returns the new root
+			static node_t* meld(node_t* a, node_t* b) {
+				if (before(b, a))
+					std::swap(a, b);
+				b->prev = a;
+				b->next = a->child;
+				if (a->child)
+					a->child->prev = b;
+				a->child = b;
+				return a;
+			}
+			//standard two pass pairing of sibling list, returns the new root
+			static node_t* merge_pairs(node_t* first) {
+				if (!first)
+					return nullptr;
+				node_t* pairs = nullptr; //melded pairs, chained through next in reverse order
+				while (first) {
+					node_t* a = first;
+					node_t* b = a->next;
+					first = b ? b->next : nullptr;
+					a->next = nullptr;
+					if (b) {
+						b->next = nullptr;
+						a = meld(a, b);
+					}
+					a->next = pairs;
+					pairs = a;
+				}
+				node_t* top = pairs;
+				pairs = pairs->next;
+				top->next = nullptr;
+				while (pairs) {
+					node_t* n = pairs;
+					pairs = pairs->next;
+					n->next = nullptr;
+					top = meld(top, n);
+				}
+				top->prev = nullptr;
+				return top;
+			}
+			bool in_fifo(const node_t* node) const {
+				return ordering == STABLE && node->rank == 0;
+			}
+			void push(node_t* node) {
+				if (in_fifo(node)) {
+					node->prev = tail;
+					(tail ? tail->next : head) = node;
+					tail = node;
+					return;
+				}
+				if (ordering == STABLE)
+					node->seq = next_seq++;
+				root = root ? meld(root, node) : node;
+			}
+			//unlinks node from any position in the queue, used by timed out waiters
+			void remove(node_t* node) {
+				if (in_fifo(node)) {
+					(node->prev ? node->prev->next : head) = node->next;
+					(node->next ? node->next->prev : tail) = node->prev;
+					return;
+				}
+				if (node == root) {
+					root = merge_pairs(root->child);
+					return;
+				}
+				if (node->prev->child == node)
+					node->prev->child = node->next;
+				else
+					node->prev->next = node->next;
+				if (node->next)
+					node->next->prev = node->prev;
+				node_t* sub = merge_pairs(node->child);
+				if (sub)
+					root = meld(root, sub);
+			}
+			//takes the first waiter that hasn't timed out off the queue, nullptr if there is none
+			node_t* pop() {
+				while (head || root) {
+					node_t* top = head;
+					if (top) {
+						head = top->next;
+						(head ? head->prev : tail) = nullptr;
+					}
+					else {
+						top = root;
+						root = merge_pairs(top->child);
+					}
+					int expected = node_t::WAITING;
+					if (top->state.compare_exchange_strong(expected, node_t::SIGNALED))
+						return top;
+					top->state.store(node_t::DROPPED); //its thread is waiting for the lock we hold, node is still valid
+				}
+				return nullptr;
+			}
+			//passes the lock to popped waiter according to signaling
+			void release(node_t* node) {
+				if (signaling == MESA) {
+					monitor_mutex->push_handoff(node);
+					return;
+				}
+				impl::monitor_waiter_t self;
+				monitor_mutex->push_urgent(&self);
+#ifdef CHECK_DEADLOCK
+				impl::lock_checker_t::released(monitor_mutex->identity());
+				{
+					impl::lock_checker_t::wait_t blocked(this, "cond", name);
+					node->hand_over();
+					self.park();
+				}
+				impl::lock_checker_t::acquired(monitor_mutex->identity(), "mutex");
+#else
+				node->hand_over();
+				self.park();
+#endif
+			}
+		public:
+			cond(impl::monitor_lock_t* & monitor_mutex, const char * name = "", ordering_t ordering = PRIORITY, signaling_t signaling = MESA)
+				: monitor_mutex(monitor_mutex), ordering(ordering), signaling(signaling), name(name) {
+#ifdef DEBUG_COND
+				DEBUG_WRITE("condition %s", "created", name);
+#endif
+			}
+			cond(cond&& rhs) :monitor_mutex(rhs.monitor_mutex), ordering(rhs.ordering), signaling(rhs.signaling), name(rhs.name) {}
+			/**
+			 *  Blocks the current process until the condition variable is woken up.
+			 *  Must be called with monitor's mutex held, as all other cond methods.
+			 *  Returns holding the mutex, which signalling thread passed over directly.
+			 *  @param uint priority Set blocked process' priority in internal blocked queue. Smaller number => higher priority.
+			 */
+			void wait(uint priority = 0) {
+				node_t node(priority);
+				push(&node);
+				//TODO: discuss whether to add check for nullptr in case user creates bare monitorable object and calls wait on cv
+				monitor_mutex->unlock();
+#ifdef DEBUG_COND
+				auto descriptor = Thread::current_descriptor();
+				DEBUG_WRITE("condition %s", "blocked thread[#%d] %s", name, descriptor.id, descriptor.name);
+#endif
+#ifdef CHECK_DEADLOCK
+				{
+					impl::lock_checker_t::wait_t blocked(this, "cond", name, priority);
+					node.park();
+				}
+				impl::lock_checker_t::acquired(monitor_mutex->identity(), "mutex"); //handed over by signalling thread
+#else
+				node.park();
+#endif
+#ifdef DEBUG_COND
+				DEBUG_WRITE("condition %s", "released thread[#%d] %s", name, descriptor.id, descriptor.name);
+#endif
+			}
+			/**
+			 *  Same as wait, but gives up after rel_time passes.
+			 *  @param uint priority Set blocked process' priority in internal blocked queue. Smaller number => higher priority.
+			 *  @return bool false if the process was not signalled before timeout
+			 */
+			template <class Rep, class Period>
+			bool wait_for(const std::chrono::duration<Rep, Period>& rel_time, uint priority = 0) {
+				const impl::deadline_t deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(rel_time);
+				node_t node(priority);
+				push(&node);
+				monitor_mutex->unlock();
+#ifdef DEBUG_COND
+				auto descriptor = Thread::current_descriptor();
+				DEBUG_WRITE("condition %s", "blocked thread[#%d] %s", name, descriptor.id, descriptor.name);
+#endif
+				bool released;
+				{
+#ifdef CHECK_DEADLOCK
+					impl::lock_checker_t::wait_t blocked(this, "cond", name, priority);
+#endif
+					released = node.park_until(deadline);
+				}
+				if (!released) {
+					int expected = node_t::WAITING;
+					if (node.state.compare_exchange_strong(expected, node_t::CANCELLED)) {
+						monitor_mutex->lock();
+						if (node.state.load() == node_t::CANCELLED) //signal hasn't dropped it meanwhile
+							remove(&node);
+					}
+					else {
+						node.park(); //signal came together with timeout, lock is on its way
+						released = true;
+					}
+				}
+#ifdef CHECK_DEADLOCK
+				if (released)
+					impl::lock_checker_t::acquired(monitor_mutex->identity(), "mutex");
+#endif
+#ifdef DEBUG_COND
+				DEBUG_WRITE("condition %s", released ? "released thread[#%d] %s" : "timed out thread[#%d] %s", name, descriptor.id, descriptor.name);
+#endif
+				return released;
+			}
+			/**
+			 * Unblock process with the highest priority from blocked queue
+			 * Smaller number => higher priority.
+			 * With HOARE signaling returns only after released process leaves the monitor or waits again.
+			 */
+			void signal() {
+				if (node_t* node = pop())
+					release(node);
+			}
+			/**
+			 * Unblock all processes from blocked queue
+			 */
+			void signalAll() {
+				if (signaling == MESA) {
+					for (node_t* node; (node = pop()) != nullptr;)
+						release(node);
+					return;
+				}
+				//take everybody off the queue first, so the ones that wait again while being served aren't released twice
+				impl::monitor_waiter_t* released = nullptr;
+				impl::monitor_waiter_t** last = &released;
+				for (node_t* node; (node = pop()) != nullptr; last = &node->next_owner)
+					*last = node;
+				*last = nullptr;
+				while (released) {
+					node_t* node = static_cast<node_t*>(released);
+					released = node->next_owner; //node belongs to its thread once released
+					release(node);
+				}
+			}
+			/**
+			 * Check whether blocked queue is empty
+			 * @return bool
+			 */
+			bool empty() const {
+				return head == nullptr && root == nullptr;
+			}
+			/**
+			 *  Check if there are processes in blocked queue
+			 * @return bool
+			 */
+			bool queue() const {
+				return !empty();
+			}
+			/**
+			 * Get the priority of the next process to be unblocked from queue.
+			 * If queue is empty returns MAXUINT
+			 * @return uint
+			 */
+			uint minrank() const {
+				return head ? 0 : root ? root->rank : -1;
+			}
+		};
+		/**
+		 * Each Monitorable object has its own condition_generator that
+		 * contains reference to its mutex and serves to deliver it to
+		 * condition variables when they are constructed
+		 */
+		class condition_generator {
+			impl::monitor_lock_t* monitor_mutex = nullptr;
+			void set_mutex(impl::monitor_lock_t* mutex) {
+				monitor_mutex = mutex;
+			}
+		public:
+			cond operator()(const char* name = "", ordering_t ordering = PRIORITY, signaling_t signaling = MESA) {
+				return cond(monitor_mutex, name, ordering, signaling);
+			}
+			template<class T>
+			friend class Monitor;
+			template<class T>
+			friend class SharedMonitor;
+			template<class T>
+			friend class CombiningMonitor;
+		};
+		condition_generator cond_gen;
+	public:
+		template<class T>
+		friend class Monitor;
+		template<class T>
+		friend class SharedMonitor;
+		template<class T>
+		friend class CombiningMonitor;
+	};
+
+	template <class T>
+	class Monitor {
+		static_assert(std::is_base_of<Monitorable, T>::value, "T must inherit from Monitorable");
+	protected:
+		mutex_t mutex; //monitor's mutex
+		impl::monitor_lock_ref_t<mutex_t> monitor_lock{ mutex }; //mutex with queues of threads it is handed over to
+		T obj; //hidden Monitorable object which methods will be called
+
+		/**
+		 * Helper class that effectively locks and unlocks the mutex on function call.
+		 * This is achieved in RAII fashion, as temporary helper object gets constructed
+		 * (thus acquiring mutex) when overloaded operator-> gets called, and immediately
+		 * after function call gets destroyed (thus releasing mutex).
+		 */
+		class helper {
+			Monitor* mon;
+		public:
+			helper(Monitor* mon) :mon(mon) {
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "trying to lock");
+#endif
+				mon->mutex.lock();
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "locking");
+#endif
+			}
+			~helper() {
+				mon->monitor_lock.unlock(); //may pass the mutex to signalled thread instead of unlocking it
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "unlocking");
+#endif
+			}
+			/**
+			 * Nifty hack to insert underlying object and create illusion of direct access
+			 */
+			T* operator->() { return &mon->obj; }
+		};
+
+	public:
+		template <typename ...Args>
+		Monitor(Args&&... args) :obj(std::forward<Args>(args)...) {
+			static_cast<Monitorable&>(obj).cond_gen.set_mutex(&monitor_lock);
+#ifdef DEBUG_MONITOR
+			DEBUG_WRITE("monitor", "created");
+#endif
+		}
+		/**
+		 * Call underlying object's function in mutually exclusive way.
+		 */
+		helper operator->() { return helper(this); }
+		/**
+		 * Returns demonitorized object. Use with caution as locking on condition
+		 * from underlying Monitorable object will lead to deadlock.
+		 */
+		T& operator*() { return obj; }
+	};
+
+	template<typename T> using monitor = Monitor<T>;
+
+	/**
+	 * Monitor that lets read-only calls run in parallel. Calls made through a const
+	 * monitor (or through read()) see the object as const and take the lock in shared
+	 * mode, while all other calls take it exclusively as in Monitor. Conds may be waited
+	 * on and signalled only from exclusive calls, queries such as empty() work in both.
+	 */
+	template <class T>
+	class SharedMonitor {
+		static_assert(std::is_base_of<Monitorable, T>::value, "T must inherit from Monitorable");
+	protected:
+		mutable SharedMutex mutex; //monitor's readers-writer lock
+		impl::monitor_lock_ref_t<SharedMutex> monitor_lock{ mutex }; //exclusive side of mutex with queues of threads it is handed over to
+		T obj; //hidden Monitorable object which methods will be called
+
+		/**
+		 * Same as Monitor::helper, holds the lock in exclusive mode for the duration of call
+		 */
+		class helper {
+			SharedMonitor* mon;
+		public:
+			helper(SharedMonitor* mon) :mon(mon) {
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "trying to lock");
+#endif
+				mon->mutex.lock();
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "locking");
+#endif
+			}
+			~helper() {
+				mon->monitor_lock.unlock(); //may pass the mutex to signalled thread instead of unlocking it
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "unlocking");
+#endif
+			}
+			T* operator->() { return &mon->obj; }
+		};
+		/**
+		 * Holds the lock in shared mode for the duration of call and exposes only const interface
+		 */
+		class shared_helper {
+			const SharedMonitor* mon;
+		public:
+			shared_helper(const SharedMonitor* mon) :mon(mon) {
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "trying to lock shared");
+#endif
+				mon->mutex.lock_shared();
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "locking shared");
+#endif
+			}
+			~shared_helper() {
+				mon->mutex.unlock_shared();
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "unlocking shared");
+#endif
+			}
+			const T* operator->() const { return &mon->obj; }
+		};
+
+	public:
+		template <typename ...Args>
+		SharedMonitor(Args&&... args) :obj(std::forward<Args>(args)...) {
+			static_cast<Monitorable&>(obj).cond_gen.set_mutex(&monitor_lock);
+#ifdef DEBUG_MONITOR
+			DEBUG_WRITE("monitor", "created");
+#endif
+		}
+		/**
+		 * Call underlying object's function in mutually exclusive way.
+		 */
+		helper operator->() { return helper(this); }
+		/**
+		 * Call underlying object's const function, concurrently with other such calls.
+		 */
+		shared_helper operator->() const { return shared_helper(this); }
+		/**
+		 * Shorthand for calling const function on non-const monitor, e.g. mon.read()->get()
+		 */
+		shared_helper read() const { return shared_helper(this); }
+		/**
+		 * Returns demonitorized object. Use with caution as locking on condition
+		 * from underlying Monitorable object will lead to deadlock.
+		 */
+		T& operator*() { return obj; }
+	};
+
+	template<typename T> using shared_monitor = SharedMonitor<T>;
+
+	/**
+	 * Monitor that executes calls by delegation (flat combining). apply(fn) publishes fn in
+	 * one of the slots and the thread that holds the lock runs all published calls in a batch,
+	 * so the object's data stays in one core's cache and contended callers don't queue on the lock.
+	 * Calls made through operator-> take the lock as in Monitor and also serve published calls
+	 * before releasing it. Delegated calls run on another thread and must not wait on conds.
+	 */
+	template <class T>
+	class CombiningMonitor {
+		static_assert(std::is_base_of<Monitorable, T>::value, "T must inherit from Monitorable");
+
+		static constexpr std::size_t max_slots = 64;
+		static constexpr int combine_passes = 3; //combiner rescans slots while it keeps finding work
+		static constexpr int max_spins = 256;    //spins on published call before queuing on the lock
+
+		//published call, lives on the stack of its caller
+		struct request_t {
+			std::atomic<bool> done{ false };
+			std::exception_ptr error;
+			virtual void run(T& obj) = 0;
+		};
+		template <class F, class R>
+		struct call_t : public request_t {
+			F& fn;
+			typename std::aligned_storage<sizeof(R), alignof(R)>::type result;
+			call_t(F& fn) :fn(fn) {}
+			void run(T& obj) override { new (&result) R(fn(obj)); }
+			R get() {
+				R* value = reinterpret_cast<R*>(&result);
+				R moved = std::move(*value);
+				value->~R();
+				return moved;
+			}
+		};
+		template <class F>
+		struct call_t<F, void> : public request_t {
+			F& fn;
+			call_t(F& fn) :fn(fn) {}
+			void run(T& obj) override { fn(obj); }
+			void get() {}
+		};
+		//references can't be placed in storage, they are passed back as pointers
+		template <class F, class R>
+		struct call_t<F, R&> : public request_t {
+			F& fn;
+			R* result = nullptr;
+			call_t(F& fn) :fn(fn) {}
+			void run(T& obj) override { result = std::addressof(fn(obj)); }
+			R& get() { return *result; }
+		};
+		template <class F, class R>
+		struct call_t<F, R&&> : public request_t {
+			F& fn;
+			R* result = nullptr;
+			call_t(F& fn) :fn(fn) {}
+			void run(T& obj) override {
+				R&& value = fn(obj);
+				result = std::addressof(value);
+			}
+			R&& get() { return std::move(*result); }
+		};
+		CachePadded<std::atomic<request_t*>> slots[max_slots]; //published calls
+		std::atomic<std::size_t> used_slots{ 0 }; //slots above this were never published to
+
+		static std::size_t my_slot() {
+			return impl::slot_index() % max_slots;
+		}
+		bool publish(request_t* request) {
+			const std::size_t first = my_slot();
+			for (std::size_t i = 0; i < max_slots; i++) {
+				const std::size_t index = (first + i) % max_slots;
+				request_t* expected = nullptr;
+				if (slots[index]->compare_exchange_strong(expected, request)) {
+					for (std::size_t used = used_slots.load(); used <= index && !used_slots.compare_exchange_weak(used, index + 1););
+					return true;
+				}
+			}
+			return false;
+		}
+		static void execute(request_t* request, T& obj) {
+			try {
+				request->run(obj);
+			}
+			catch (...) {
+				request->error = std::current_exception();
+			}
+			request->done.store(true, std::memory_order_release); //request may be gone right after this
+		}
+		//runs published calls, called with lock held
+		void combine() {
+			for (int pass = 0; pass < combine_passes; pass++) {
+				bool found = false;
+				for (std::size_t i = 0, used = used_slots.load(); i < used; i++)
+					if (request_t* request = slots[i]->exchange(nullptr)) {
+						execute(request, obj);
+						found = true;
+					}
+				if (!found)
+					break;
+			}
+		}
+		void release() {
+			combine();
+			monitor_lock.unlock();
+		}
+	protected:
+		mutex_t mutex; //monitor's mutex
+		impl::monitor_lock_ref_t<mutex_t> monitor_lock{ mutex }; //mutex with queues of threads it is handed over to
+		T obj; //hidden Monitorable object which methods will be called
+
+		/**
+		 * Same as Monitor::helper, but serves published calls before releasing the lock
+		 */
+		class helper {
+			CombiningMonitor* mon;
+		public:
+			helper(CombiningMonitor* mon) :mon(mon) {
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "trying to lock");
+#endif
+				mon->mutex.lock();
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "locking");
+#endif
+			}
+			~helper() {
+				mon->release();
+#ifdef DEBUG_MONITOR
+				DEBUG_WRITE("monitor", "unlocking");
+#endif
+			}
+			T* operator->() { return &mon->obj; }
+		};
+
+	public:
+		template <typename ...Args>
+		CombiningMonitor(Args&&... args) :obj(std::forward<Args>(args)...) {
+			static_cast<Monitorable&>(obj).cond_gen.set_mutex(&monitor_lock);
+#ifdef DEBUG_MONITOR
+			DEBUG_WRITE("monitor", "created");
+#endif
+		}
+		/**
+		 * Call underlying object's function in mutually exclusive way.
+		 */
+		helper operator->() { return helper(this); }
+		/**
+		 * Runs fn(obj) in mutually exclusive way, possibly on the thread that currently holds
+		 * the lock together with other published calls. Rethrows exception thrown by fn.
+		 * @return Whatever fn returns
+		 */
+		template <class F>
+		auto apply(F&& fn) -> decltype(fn(std::declval<T&>())) {
+			call_t<F, decltype(fn(std::declval<T&>()))> call(fn);
+			if (!publish(&call)) {
+				//all slots taken, run it ourselves
+				mutex.lock();
+				execute(&call, obj);
+				release();
+			}
+			for (int spins = impl::spinning_allowed() ? max_spins : 0; !call.done.load(std::memory_order_acquire); spins--) {
+				if (spins <= 0)
+					mutex.lock();
+				else if (!mutex.try_lock()) {
+					impl::cpu_relax();
+					continue;
+				}
+				//holding the lock, our call either ran already or is still in its slot
+				release();
+			}
+			if (call.error)
+				std::rethrow_exception(call.error);
+			return call.get();
+		}
+		/**
+		 * Returns demonitorized object. Use with caution as locking on condition
+		 * from underlying Monitorable object will lead to deadlock.
+		 */
+		T& operator*() { return obj; }
+	};
+	template <class T>
+	constexpr std::size_t CombiningMonitor<T>::max_slots;
+	template <class T>
+	constexpr int CombiningMonitor<T>::combine_passes;
+	template <class T>
+	constexpr int CombiningMonitor<T>::max_spins;
+
+	template<typename T> using combining_monitor = CombiningMonitor<T>;
+
+	/**
+	 * Read-mostly holder of immutable T versions (read-copy-update). Readers take a snapshot
+	 * without any lock, entering a reader epoch on a counter slot of their own. Writers publish
+	 * a new version, flip the epoch and delete the old version once every reader that could
+	 * still see it has left.
+	 */
+	template <class T>
+	class Rcu {
+		static constexpr std::size_t max_slots = 64;
+		struct slot_t {
+			std::atomic<int> readers[2]; //readers in each of the two epochs
+		};
+
+		CachePadded<slot_t> slots[max_slots];
+		std::atomic<int> epoch{ 0 }; //parity of the epoch new readers enter
+		std::atomic<int> synchronizing{ 0 }; //writer is waiting for readers to leave
+		std::atomic<T*> current;
+		Mutex writers; //serializes writers among themselves
+#ifdef CHECK_DEADLOCK
+		std::mutex holders_mutex;
+		std::unordered_multiset<std::size_t> holders; //slot indices of threads and fibers holding a reader
+#endif
+
+		//number of slots in use, enough to give each hardware thread its own
+		static std::size_t slot_count() {
+			static const std::size_t count = [] {
+				std::size_t count = 1;
+				while (count < std::thread::hardware_concurrency() && count < max_slots)
+					count *= 2;
+				return count;
+			}();
+			return count;
+		}
+		slot_t& my_slot() {
+			return *slots[impl::slot_index() % slot_count()];
+		}
+		void wait_for_readers(int parity) {
+			for (std::size_t i = 0; i < slot_count(); i++)
+				for (int n; (n = slots[i]->readers[parity].load()) != 0;)
+					impl::futex_wait(&slots[i]->readers[parity], n);
+		}
+#ifdef CHECK_DEADLOCK
+		void check_not_reading(const char* operation) {
+			std::unique_lock<std::mutex> lock(holders_mutex);
+			if (holders.count(impl::slot_index()))
+				throw std::logic_error(std::string("Rcu::") + operation + ": caller holds a reader, waiting for readers would never end");
+		}
+#endif
+		//after return no reader holds a version replaced before the call
+		void synchronize() {
+			const int parity = epoch.load();
+			synchronizing.store(1);
+			wait_for_readers(parity ^ 1); //readers that entered the previous epoch late
+			epoch.store(parity ^ 1);
+			wait_for_readers(parity);
+			synchronizing.store(0);
+		}
+	public:
+		/**
+		 * Snapshot of the version that was current when it was taken, valid while the reader lives
+		 */
+		class reader {
+			Rcu* rcu;
+			std::atomic<int>* readers;
+			const T* value;
+#ifdef CHECK_DEADLOCK
+			std::size_t holder = impl::slot_index();
+#endif
+		public:
+			reader(Rcu* rcu) :rcu(rcu) {
+#ifdef CHECK_DEADLOCK
+				{
+					std::unique_lock<std::mutex> lock(rcu->holders_mutex);
+					rcu->holders.insert(holder);
+				}
+#endif
+				const int parity = rcu->epoch.load();
+				readers = &rcu->my_slot().readers[parity];
+				readers->fetch_add(1);
+				value = rcu->current.load();
+			}
+			reader(reader&& other) :rcu(other.rcu), readers(other.readers), value(other.value) {
+#ifdef CHECK_DEADLOCK
+				holder = other.holder;
+#endif
+				other.readers = nullptr;
+			}
+			reader(const reader&) = delete;
+			reader& operator=(const reader&) = delete;
+			~reader() {
+				if (!readers)
+					return;
+#ifdef CHECK_DEADLOCK
+				{
+					std::unique_lock<std::mutex> lock(rcu->holders_mutex);
+					rcu->holders.erase(rcu->holders.find(holder));
+				}
+#endif
+				if (readers->fetch_sub(1) == 1 && rcu->synchronizing.load() != 0)
+					impl::futex_wake(readers, 1);
+			}
+			const T* operator->() const { return value; }
+			const T& operator*() const { return *value; }
+			const T* get() const { return value; }
+		};
+
+		template <typename ...Args>
+		Rcu(Args&&... args) :current(new T(std::forward<Args>(args)...)) {}
+		Rcu(const Rcu&) = delete;
+		Rcu& operator=(const Rcu&) = delete;
+		~Rcu() { delete current.load(); }
+
+		/**
+		 * Takes a snapshot of the current version
+		 */
+		reader read() { return reader(this); }
+		/**
+		 * Makes next the current version, waits until readers leave the old one and deletes it.
+		 * Caller must not hold a reader of this Rcu, it would wait for it forever. With
+		 * CHECK_DEADLOCK defined that throws std::logic_error instead.
+		 */
+		void publish(std::unique_ptr<T> next) {
+#ifdef CHECK_DEADLOCK
+			check_not_reading("publish");
+#endif
+			std::unique_lock<Mutex> lock(writers);
+			std::unique_ptr<T> old(current.exchange(next.release()));
+			synchronize();
+		}
+		/**
+		 * Publishes a copy of the current version modified by fn(T&). Same as with publish,
+		 * caller must not hold a reader of this Rcu
+		 */
+		template <class F>
+		void update(F&& fn) {
+#ifdef CHECK_DEADLOCK
+			check_not_reading("update");
+#endif
+			std::unique_lock<Mutex> lock(writers);
+			std::unique_ptr<T> next(new T(*current.load()));
+			fn(*next);
+			std::unique_ptr<T> old(current.exchange(next.release()));
+			synchronize();
+		}
+	};
+	template <class T>
+	constexpr std::size_t Rcu<T>::max_slots;
+
+	template<typename T> using rcu = Rcu<T>;
+
+	namespace impl {
+		/**
+		 * Lets threads sleep until some lock-free condition may have changed. Waiter registers
+		 * with prepare_wait, rechecks its condition and only then calls wait, notifier changes
+		 * the condition first and then calls notify, so a notification is never missed.
+		 * Notify starts a new epoch and releases all registered waiters at once, so further
+		 * notifications are free until somebody registers again.
+		 */
+		class event_count_t {
+			static constexpr std::uint64_t waiter_mask = 0xFFFFFFFFu;
+			//low half counts registered waiters, high half is the epoch, which waiters sleep on
+			std::atomic<std::uint64_t> state{ 0 };
+			static_assert(sizeof(std::atomic<std::uint64_t>) == 2 * sizeof(std::atomic<int>), "epoch must be addressable as futex word");
+
+			static int epoch_of(std::uint64_t state) {
+				return static_cast<int>(static_cast<std::uint32_t>(state >> 32));
+			}
+			std::atomic<int>* epoch_word() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+				return reinterpret_cast<std::atomic<int>*>(&state);
+#else
+				return reinterpret_cast<std::atomic<int>*>(&state) + 1;
+#endif
+			}
+		public:
+			int prepare_wait() {
+				const int key = epoch_of(state.fetch_add(1));
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				return key;
+			}
+			void cancel_wait(int key) {
+				std::uint64_t s = state.load();
+				while (epoch_of(s) == key && !state.compare_exchange_weak(s, s - 1)); //otherwise notify already released us
+			}
+			void wait(int key) {
+				while (epoch_of(state.load()) == key)
+					futex_wait(epoch_word(), key);
+			}
+			void notify() {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				std::uint64_t s = state.load();
+				do {
+					if ((s & waiter_mask) == 0)
+						return;
+				} while (!state.compare_exchange_weak(s, ((s >> 32) + 1) << 32)); //next epoch, nobody registered
+				futex_wake(epoch_word(), INT_MAX);
+			}
+		};
+		constexpr std::uint64_t event_count_t::waiter_mask;
+	}
+
+	/**
+	 * Bounded multi-producer multi-consumer queue. Items are passed through a lock-free ring
+	 * (Vyukov's bounded MPMC queue), threads park only when it is empty or full.
+	 * After close, pushes fail and pops drain what is left and then fail.
+	 */
+	template <class T>
+	class Channel {
+		struct cell_t {
+			std::atomic<std::size_t> sequence;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		};
+
+		//producers' and consumers' words each on lines of their own, ring parameters below are read-only
+		CachePadded<std::atomic<std::size_t>> tail{ 0 }; //next position to push to
+		CachePadded<std::atomic<int>> pushing{ 0 }; //pushes in progress, pop must not give up on closed channel before they end
+		CachePadded<std::atomic<std::size_t>> head{ 0 }; //next position to pop from
+		CachePadded<impl::event_count_t> not_empty;
+		CachePadded<impl::event_count_t> not_full;
+		CachePadded<std::atomic<bool>> is_closed{ false };
+		const std::size_t mask;
+		std::unique_ptr<cell_t[]> cells;
+
+		static std::size_t round_up(std::size_t capacity) {
+			std::size_t size = 1;
+			while (size < capacity)
+				size *= 2;
+			return size;
+		}
+		template <class U>
+		bool try_enqueue(U&& item) {
+			std::size_t pos = tail->load(std::memory_order_relaxed);
+			cell_t* cell;
+			while (true) {
+				cell = &cells[pos & mask];
+				std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+				if (diff == 0) {
+					if (tail->compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = tail->load(std::memory_order_relaxed);
+			}
+			new (&cell->storage) T(std::forward<U>(item));
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+		bool try_dequeue(T& item) {
+			std::size_t pos = head->load(std::memory_order_relaxed);
+			cell_t* cell;
+			while (true) {
+				cell = &cells[pos & mask];
+				std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+				if (diff == 0) {
+					if (head->compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = head->load(std::memory_order_relaxed);
+			}
+			T* stored = reinterpret_cast<T*>(&cell->storage);
+			item = std::move(*stored);
+			stored->~T();
+			cell->sequence.store(pos + mask + 1, std::memory_order_release);
+			return true;
+		}
+		//true once channel is closed and every push that could still deliver has ended
+		bool drained() {
+			if (!is_closed->load())
+				return false;
+			//push that passed the closed check is about to finish, parking lets it run even on the same thread
+			for (int n; (n = pushing->load()) != 0;)
+				impl::futex_wait(&*pushing, n);
+			return true;
+		}
+		void end_push() {
+			if (pushing->fetch_sub(1) == 1 && is_closed->load())
+				impl::futex_wake(&*pushing, INT_MAX); //pops may be waiting in drained
+		}
+		//parks until an item may be available, false if channel is closed and empty
+		bool await_item(T& item) {
+			while (!try_dequeue(item)) {
+				const int key = not_empty->prepare_wait();
+				if (try_dequeue(item)) {
+					not_empty->cancel_wait(key);
+					break;
+				}
+				if (drained()) {
+					not_empty->cancel_wait(key);
+					return try_dequeue(item);
+				}
+				not_empty->wait(key);
+			}
+			return true;
+		}
+		template <class U>
+		bool push_impl(U&& item) {
+			pushing->fetch_add(1);
+			bool pushed = false;
+			//try_enqueue moves from item only when it succeeds
+			while (!is_closed->load() && !(pushed = try_enqueue(std::forward<U>(item)))) {
+				const int key = not_full->prepare_wait();
+				if (is_closed->load() || (pushed = try_enqueue(std::forward<U>(item)))) {
+					not_full->cancel_wait(key);
+					break;
+				}
+				not_full->wait(key);
+			}
+			end_push();
+			if (pushed)
+				not_empty->notify();
+			return pushed;
+		}
+	public:
+		/**
+		 * @param std::size_t capacity Rounded up to power of two
+		 */
+		Channel(std::size_t capacity = 64) :mask(round_up(std::max<std::size_t>(capacity, 2)) - 1), cells(new cell_t[mask + 1]) {
+			for (std::size_t i = 0; i <= mask; i++)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		Channel(const Channel&) = delete;
+		Channel& operator=(const Channel&) = delete;
+		~Channel() {
+			for (std::size_t pos = head->load(); pos != tail->load(); pos++)
+				reinterpret_cast<T*>(&cells[pos & mask].storage)->~T();
+		}
+		/**
+		 * Blocks while channel is full
+		 * @return bool false if channel was closed and item wasn't pushed
+		 */
+		bool push(const T& item) {
+			return push_impl(item);
+		}
+		bool push(T&& item) {
+			return push_impl(std::move(item));
+		}
+		/**
+		 * Pushes only if there is room right away
+		 * @return bool Whether item was pushed
+		 */
+		bool try_push(const T& item) {
+			if (is_closed->load() || !try_enqueue(item))
+				return false;
+			not_empty->notify();
+			return true;
+		}
+		/**
+		 * Blocks while channel is empty
+		 * @return bool false if channel is closed and no items are left
+		 */
+		bool pop(T& item) {
+			if (!await_item(item))
+				return false;
+			not_full->notify();
+			return true;
+		}
+		/**
+		 * Pops only if an item is available right away
+		 * @return bool Whether item was popped
+		 */
+		bool try_pop(T& item) {
+			if (!try_dequeue(item))
+				return false;
+			not_full->notify();
+			return true;
+		}
+		/**
+		 * Pushes items from [first, last), blocking whenever channel is full.
+		 * Consumers are woken once per filled stretch rather than once per item.
+		 * @return std::size_t Number of items pushed, less than requested if channel was closed
+		 */
+		template <class InputIt>
+		std::size_t push(InputIt first, InputIt last) {
+			std::size_t count = 0;
+			while (first != last) {
+				std::size_t batch = 0;
+				pushing->fetch_add(1);
+				if (!is_closed->load())
+					for (; first != last && try_enqueue(*first); ++first)
+						batch++;
+				end_push();
+				if (batch) {
+					count += batch;
+					not_empty->notify();
+				}
+				else if (!push(*first)) //full or closed, wait for room one item at a time
+					break;
+				else {
+					++first;
+					count++;
+				}
+			}
+			return count;
+		}
+		/**
+		 * Blocks until at least one item is available, then pops up to max items without blocking
+		 * @return std::size_t Number of items written to out, 0 if channel is closed and empty
+		 */
+		template <class OutputIt>
+		std::size_t pop(OutputIt out, std::size_t max) {
+			T item;
+			if (max == 0 || !await_item(item))
+				return 0;
+			*out++ = std::move(item);
+			std::size_t count = 1;
+			while (count < max && try_dequeue(item)) {
+				*out++ = std::move(item);
+				count++;
+			}
+			not_full->notify();
+			return count;
+		}
+		/**
+		 * Rejects further pushes and wakes up everybody blocked on the channel
+		 */
+		void close() {
+			is_closed->store(true);
+			not_empty->notify();
+			not_full->notify();
+		}
+		bool closed() const {
+			return is_closed->load();
+		}
+		std::size_t capacity() const {
+			return mask + 1;
+		}
+
+		/**
+		 * Input iterator that pops items until channel is closed and drained, for use in range-based for
+		 */
+		class iterator {
+			Channel* channel;
+			T item;
+			void next() {
+				if (channel && !channel->pop(item))
+					channel = nullptr;
+			}
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef T value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef T* pointer;
+			typedef T& reference;
+
+			iterator(Channel* channel = nullptr) :channel(channel) { next(); }
+			T& operator*() { return item; }
+			T* operator->() { return &item; }
+			iterator& operator++() { next(); return *this; }
+			bool operator==(const iterator& rhs) const { return channel == rhs.channel; }
+			bool operator!=(const iterator& rhs) const { return channel != rhs.channel; }
+		};
+		iterator begin() {
+			return iterator(this);
+		}
+		iterator end() {
+			return iterator();
+		}
+	};
+
+	/**
+	 * Single-use countdown. Threads wait until count_down was called count times in total.
+	 */
+	class Latch {
+		std::atomic<int> count;
+	public:
+		Latch(int count) :count(count) {}
+		Latch(const Latch&) = delete;
+		Latch& operator=(const Latch&) = delete;
+
+		/**
+		 * Decrements count by n. Counting past zero is allowed and counts as reaching it
+		 */
+		void count_down(int n = 1) {
+			const int old = count.fetch_sub(n);
+			if (old > 0 && old - n <= 0)
+				impl::futex_wake(&count, INT_MAX);
+		}
+		/**
+		 * Blocks until count reaches zero
+		 */
+		void wait() {
+			for (int c; (c = count.load()) > 0;)
+				impl::futex_wait(&count, c);
+		}
+		bool try_wait() const {
+			return count.load() <= 0;
+		}
+		void arrive_and_wait(int n = 1) {
+			count_down(n);
+			wait();
+		}
+	};
+
+	/**
+	 * Cyclic barrier for fixed number of parties. Once the last party arrives completion
+	 * is called on its thread, then all parties are released and the barrier is reset.
+	 * Parties are released even if completion throws, the exception goes to the last party.
+	 * Phase and number of arrived parties share one futex word, so arriving is a single atomic add.
+	 */
+	class Barrier {
+		static constexpr int phase_shift = 16; //low bits count arrived parties (up to 65535), high bits are phase
+		static constexpr int arrived_mask = (1 << phase_shift) - 1;
+
+		std::atomic<int> state{ 0 };
+		const int parties;
+		std::function<void()> completion;
+
+		static unsigned phase_of(int state) {
+			return static_cast<unsigned>(state) >> phase_shift;
+		}
+		//resets arrivals and releases parties waiting on phase
+		void advance(unsigned phase) {
+			state.store(static_cast<int>((phase + 1) << phase_shift));
+			impl::futex_wake(&state, INT_MAX);
+		}
+	public:
+		/**
+		 * @throws std::invalid_argument when parties is not in [1, 65535], as arrivals would spill into phase
+		 */
+		Barrier(int parties, std::function<void()> completion = nullptr) :parties(parties), completion(std::move(completion)) {
+			if (parties <= 0 || parties > arrived_mask)
+				throw std::invalid_argument("Barrier: parties must be in [1, 65535]");
+		}
+		Barrier(const Barrier&) = delete;
+		Barrier& operator=(const Barrier&) = delete;
+
+		/**
+		 * Blocks until all parties arrive
+		 * @return bool true for the one party that arrived last and ran completion
+		 */
+		bool arrive_and_wait() {
+			const int arrival = state.fetch_add(1);
+			const unsigned phase = phase_of(arrival);
+			if ((arrival & arrived_mask) + 1 == parties) {
+				if (completion) {
+					try {
+						completion();
+					}
+					catch (...) {
+						advance(phase);
+						throw;
+					}
+				}
+				advance(phase);
+				return true;
+			}
+			for (int s; phase_of(s = state.load()) == phase;)
+				impl::futex_wait(&state, s);
+			return false;
+		}
+		int get_parties() const {
+			return parties;
+		}
+	};
+	constexpr int Barrier::phase_shift;
+	constexpr int Barrier::arrived_mask;
+
+	/**
+	 * Reusable barrier with dynamic number of parties. Parties can register and deregister
+	 * at any time, each phase ends when all parties registered for it have arrived. Parties
+	 * that only signal arrival do not have to wait for the others.
+	 * Phase, parties and unarrived parties are packed in one atomic word that is updated with
+	 * a single CAS, waiters park on a separate futex word with the current phase.
+	 */
+	class Phaser {
+		static constexpr int count_bits = 16; //parties and unarrived, up to 65535 each
+		static constexpr std::uint64_t count_mask = (1u << count_bits) - 1;
+
+		std::atomic<std::uint64_t> state;
+		std::atomic<int> phase_word{ 0 };
+
+		static std::uint64_t pack(std::uint32_t phase, std::uint64_t parties, std::uint64_t unarrived) {
+			return static_cast<std::uint64_t>(phase) << (2 * count_bits) | parties << count_bits | unarrived;
+		}
+		static std::uint32_t phase_of(std::uint64_t s) {
+			return static_cast<std::uint32_t>(s >> (2 * count_bits));
+		}
+		static std::uint64_t parties_of(std::uint64_t s) {
+			return (s >> count_bits) & count_mask;
+		}
+		static std::uint64_t unarrived_of(std::uint64_t s) {
+			return s & count_mask;
+		}
+		//phases from -> to, correct across wrap around as long as they are less than 2^31 apart
+		static int distance(int from, int to) {
+			return static_cast<int>(static_cast<unsigned>(to) - static_cast<unsigned>(from));
+		}
+		//arrives and leaves parties - deregistered parties, advancing to the next phase if this was the last arrival
+		int arrive_impl(std::uint64_t deregistered) {
+			std::uint64_t s = state.load();
+			std::uint64_t next;
+			do {
+				//unarrived is only 0 with no parties, after the last one deregistered or when none were registered
+				if (unarrived_of(s) == 0)
+					throw std::logic_error("Phaser: arrival without a registered party");
+				const std::uint64_t parties = parties_of(s) - deregistered;
+				const std::uint64_t unarrived = unarrived_of(s) - 1;
+				next = unarrived == 0 ? pack(phase_of(s) + 1, parties, parties) : pack(phase_of(s), parties, unarrived);
+			} while (!state.compare_exchange_weak(s, next));
+			if (phase_of(next) != phase_of(s)) {
+				//deregistered or non-waiting parties may let the next phase finish before we publish this one
+				const int phase = static_cast<int>(phase_of(next));
+				int published = phase_word.load();
+				while (distance(published, phase) > 0 && !phase_word.compare_exchange_weak(published, phase));
+				impl::futex_wake(&phase_word, INT_MAX);
+			}
+			return static_cast<int>(phase_of(s));
+		}
+	public:
+		Phaser(int parties = 0) :state(pack(0, parties, parties)) {}
+		Phaser(const Phaser&) = delete;
+		Phaser& operator=(const Phaser&) = delete;
+
+		/**
+		 * Adds a party that takes part starting with current phase
+		 * @return int Current phase
+		 */
+		int register_party() {
+			std::uint64_t s = state.load();
+			while (!state.compare_exchange_weak(s, pack(phase_of(s), parties_of(s) + 1, unarrived_of(s) + 1)));
+			return static_cast<int>(phase_of(s));
+		}
+		/**
+		 * Signals arrival of a party without waiting for the others
+		 * @return int Phase the party arrived at
+		 * @throws std::logic_error when no party is registered
+		 */
+		int arrive() {
+			return arrive_impl(0);
+		}
+		/**
+		 * Signals arrival and removes the party from subsequent phases. Phaser stays usable after
+		 * the last party leaves, parties registered later start at the then current phase
+		 * @return int Phase the party arrived at
+		 * @throws std::logic_error when no party is registered
+		 */
+		int arrive_and_deregister() {
+			return arrive_impl(1);
+		}
+		/**
+		 * Blocks until phaser moves past phase
+		 * @return int Phase that is current after return
+		 */
+		int await_advance(int phase) {
+			//published phase may already be several phases ahead
+			for (int current; distance(phase, current = phase_word.load()) <= 0;)
+				impl::futex_wait(&phase_word, current);
+			return phase_word.load();
+		}
+		/**
+		 * Signals arrival and blocks until all other parties arrive
+		 * @return int Phase that is current after return
+		 */
+		int arrive_and_await_advance() {
+			return await_advance(arrive());
+		}
+		int get_phase() const {
+			return static_cast<int>(phase_of(state.load()));
+		}
+		int get_parties() const {
+			return static_cast<int>(parties_of(state.load()));
+		}
+		int get_unarrived() const {
+			return static_cast<int>(unarrived_of(state.load()));
+		}
+	};
+	constexpr int Phaser::count_bits;
+	constexpr std::uint64_t Phaser::count_mask;
+}
+
+namespace MPI {
+	using namespace std::chrono_literals;
+	typedef uint_fast32_t priority_t;
+	typedef uint_fast8_t status_t;
+	typedef unsigned int uint;
+	typedef std::chrono::duration<long, std::milli> duration_t;
+	typedef std::chrono::time_point< std::chrono::high_resolution_clock > timestamp_t;
+
+	enum { VERY_HIGH, HIGH, MEDIUM, LOW, VERY_LOW };
+	enum { SUCCESS, TIMEOUT, EXPIRED, FULL, DROPPED };
+
+	/**
+	 * What put does when mailbox is at capacity
+	 */
+	enum overflow_t {
+		BLOCK,         //wait until there is space
+		BLOCK_TIMEOUT, //wait up to mailbox's block timeout, then drop the message
+		DROP_NEWEST,   //drop the message being put
+		DROP_LOWEST,   //evict the oldest of the lowest priority messages, unless the new one has even lower priority
+		GROW           //ignore capacity
+	};
+
+	template <class T>
+	class MessageBox {
+	public:
+		virtual void put(const T& message, priority_t p = MEDIUM, const duration_t& ttl = 0ms) = 0;
+		virtual T get(const duration_t& ttd = 0ms, status_t* status = nullptr) = 0;
+		virtual ~MessageBox() {}
+		/**
+		 * Lets mailboxes that synchronize on their own be used with the same
+		 * mbx->put(...) syntax as monitored ones, so they can be swapped freely.
+		 */
+		MessageBox* operator->() { return this; }
+	};
+	/**
+	 * Shared notifier that lets one thread wait on several mailboxes at once.
+	 * Mailboxes that have it attached report every put together with the index
+	 * under which it was attached, so readiness is kept in order of arrival.
+	 */
+	class Notifier {
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::deque<std::size_t> ready;
+	public:
+		void notify(std::size_t index) {
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.push_back(index);
+			cond.notify_one();
+		}
+		/**
+		 * Blocks until some attached mailbox reported a message or ttd passes (0ms => wait forever).
+		 * @return int Index of the first mailbox that became ready, -1 on timeout
+		 */
+		int wait(const duration_t& ttd) {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (ttd == 0ms)
+				cond.wait(lock, [this] { return !ready.empty(); });
+			else if (!cond.wait_for(lock, ttd, [this] { return !ready.empty(); }))
+				return -1;
+			return static_cast<int>(ready.front());
+		}
+	};
+
+	template <class T>
+	class MonitorableMessageBox : public MessageBox<T>, public Concurrent::Monitorable {
+		cond notFull = cond_gen("notFull", STABLE);
+		cond notEmpty = cond_gen("notEmpty", STABLE);
+
+		uint capacity;
+		overflow_t policy;
+		duration_t block_timeout;
+		std::vector<std::pair<Notifier*, std::size_t>> notifiers;
+
+		struct MessageWrap {
+			T message;
+			priority_t p;
+			duration_t ttl;
+			timestamp_t ts;
+			uint64_t seq;
+			MessageWrap(const T& message, priority_t p, const duration_t& ttl, uint64_t seq) :message(message), p(p), ttl(ttl), ts(std::chrono::high_resolution_clock::now()), seq(seq) {}
+			friend bool operator>(const MessageWrap& mw1, const MessageWrap& mw2) { return mw1.p != mw2.p ? mw1.p > mw2.p : mw1.seq > mw2.seq; }
+		};
+
+		//heap ordered by priority and arrival, kept in vector so that overflow can evict from it
+		typedef std::vector<MessageWrap> buffer_t;
+		buffer_t buffer;
+		uint64_t next_seq = 0;
+		const char* m_name;
+	public:
+		struct stats_t {
+			uint64_t put = 0;       //messages accepted into mailbox
+			uint64_t dropped = 0;   //messages dropped by overflow policy, including timed out blocking puts
+			uint64_t evicted = 0;   //buffered messages evicted by DROP_LOWEST
+			uint64_t rejected = 0;  //try_put and put_for calls that gave up on a full mailbox
+			std::size_t peak = 0;   //largest number of buffered messages
+			std::chrono::nanoseconds blocked{ 0 }; //total time puts spent waiting for space
+		};
+	private:
+		stats_t m_stats;
+
+		/**
+		 * Waits until there is space in mailbox or timeout passes (0ms => no timeout)
+		 * @return bool false if timed out while still full
+		 */
+		bool wait_not_full(const duration_t& timeout) {
+			if (!full())
+				return true;
+			auto start = std::chrono::high_resolution_clock::now();
+			if (timeout == 0ms) {
+				while (full())
+					notFull.wait();
+			}
+			else {
+				auto deadline = start + timeout;
+				while (full() && notFull.wait_for(deadline - std::chrono::high_resolution_clock::now()));
+			}
+			m_stats.blocked += std::chrono::high_resolution_clock::now() - start;
+			return !full();
+		}
+		void push(const T& message, priority_t p, const duration_t& ttl) {
+			buffer.emplace_back(message, p, ttl, next_seq++);
+			std::push_heap(buffer.begin(), buffer.end(), std::greater<MessageWrap>());
+			m_stats.put++;
+			m_stats.peak = std::max(m_stats.peak, buffer.size());
+			notEmpty.signal();
+			for (auto& notifier : notifiers)
+				notifier.first->notify(notifier.second);
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("MessageBox(%s)", "message put", m_name);
+#endif
+		}
+		status_t drop() {
+			m_stats.dropped++;
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("MessageBox(%s)", "message dropped", m_name);
+#endif
+			return DROPPED;
+		}
+		/**
+		 * Makes room for message of priority p by evicting the oldest of the lowest priority messages
+		 * @return bool false if every buffered message has higher priority than p
+		 */
+		bool evict(priority_t p) {
+			auto victim = buffer.begin();
+			for (auto iter = buffer.begin(); iter != buffer.end(); iter++)
+				if (iter->p > victim->p || (iter->p == victim->p && iter->seq < victim->seq))
+					victim = iter;
+			if (victim == buffer.end() || victim->p < p)
+				return false;
+			buffer.erase(victim);
+			std::make_heap(buffer.begin(), buffer.end(), std::greater<MessageWrap>());
+			m_stats.evicted++;
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("MessageBox(%s)", "message evicted", m_name);
+#endif
+			return true;
+		}
+		/**
+		 * Applies overflow policy to message, blocking policies wait at most timeout (0ms => no timeout)
+		 */
+		status_t put_impl(const T& message, priority_t p, const duration_t& ttl, bool may_block, const duration_t& timeout) {
+			if (full()) {
+				switch (policy) {
+				case BLOCK:
+				case BLOCK_TIMEOUT:
+					if (!may_block) {
+						m_stats.rejected++;
+						return FULL;
+					}
+					if (!wait_not_full(timeout))
+						return TIMEOUT;
+					break;
+				case DROP_NEWEST:
+					return drop();
+				case DROP_LOWEST:
+					if (!evict(p))
+						return drop();
+					break;
+				case GROW:
+					break;
+				}
+			}
+			push(message, p, ttl);
+			return SUCCESS;
+		}
+	public:
+		/**
+		 * @param overflow_t policy What put does when mailbox is full
+		 * @param duration_t block_timeout How long put waits for space under BLOCK_TIMEOUT policy
+		 */
+		MonitorableMessageBox(uint capacity = 10, const char* name = "", overflow_t policy = BLOCK, const duration_t& block_timeout = 0ms)
+			: capacity(capacity), policy(policy), block_timeout(block_timeout), m_name(name) {}
+		void put(const T& message, priority_t p = MEDIUM, const duration_t& ttl = 0ms) override {
+			if (put_impl(message, p, ttl, true, policy == BLOCK_TIMEOUT ? block_timeout : 0ms) == TIMEOUT)
+				drop();
+		}
+		/**
+		 * Puts message without ever blocking. Blocking policies report FULL instead of waiting,
+		 * others behave as with put.
+		 * @return status_t SUCCESS, FULL or DROPPED
+		 */
+		status_t try_put(const T& message, priority_t p = MEDIUM, const duration_t& ttl = 0ms) {
+			return put_impl(message, p, ttl, false, 0ms);
+		}
+		/**
+		 * Puts message, waiting at most timeout for space under blocking policies
+		 * @return status_t SUCCESS, TIMEOUT or DROPPED
+		 */
+		status_t put_for(const T& message, const duration_t& timeout, priority_t p = MEDIUM, const duration_t& ttl = 0ms) {
+			if (timeout == 0ms)
+				return try_put(message, p, ttl);
+			status_t status = put_impl(message, p, ttl, true, timeout);
+			if (status == TIMEOUT)
+				m_stats.rejected++;
+			return status;
+		}
+		T get(const duration_t& ttd = 0ms, status_t* status = nullptr) override {
+			auto deadline = std::chrono::high_resolution_clock::now() + ttd;
+			while (buffer.empty()) {
+				if (ttd == 0ms)
+					notEmpty.wait();
+				else if (!notEmpty.wait_for(deadline - std::chrono::high_resolution_clock::now()) && buffer.empty()) {
+#ifdef DEBUG_MPI
+					DEBUG_WRITE("MessageBox(%s)", "message timed out", m_name);
+#endif
+					if (status) *status = TIMEOUT;
+					return T();
+				}
+			}
+			std::pop_heap(buffer.begin(), buffer.end(), std::greater<MessageWrap>());
+			auto msg_wrap = buffer.back();
+			buffer.pop_back();
+			notFull.signal();
+
+			if (msg_wrap.ttl != 0ms && std::chrono::high_resolution_clock::now() - msg_wrap.ts > msg_wrap.ttl) {
+#ifdef DEBUG_MPI
+				DEBUG_WRITE("MessageBox(%s)", "message expired", m_name);
+#endif
+				if (status) *status = EXPIRED;
+				return T(); //TODO: discuss whether it is better to enforce the user to overload cast operator or to have specific constructor if this fails or to leave it like this
+			}
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("MessageBox(%s)", "message recieved", m_name);
+#endif
+			if (status) *status = SUCCESS;
+			return msg_wrap.message;
+		}
+		const char* name() const { return m_name; }
+		std::size_t size() const { return buffer.size(); }
+		bool empty() const { return buffer.empty(); }
+		bool full() const { return policy != GROW && buffer.size() >= capacity; }
+		stats_t stats() const { return m_stats; }
+		/**
+		 * Attach notifier that will be told about every subsequent put under given index.
+		 * @return bool Whether mailbox already holds messages at the moment of attaching
+		 */
+		bool attach(Notifier* notifier, std::size_t index) {
+			notifiers.emplace_back(notifier, index);
+			return !buffer.empty();
+		}
+		void detach(Notifier* notifier) {
+			notifiers.erase(std::remove_if(notifiers.begin(), notifiers.end(), [notifier](const std::pair<Notifier*, std::size_t>& entry) {
+				return entry.first == notifier;
+			}), notifiers.end());
+		}
+	};
+
+	template<typename T> using MonitorMessageBox = Concurrent::monitor<MonitorableMessageBox<T>>;
+
+	namespace impl {
+		template <typename Iter>
+		int select(Iter first, Iter last, const duration_t& ttd, status_t* status) {
+			//rotate starting mailbox on every call so that boxes which are ready at once take turns
+			static thread_local std::size_t rotation = 0;
+			const std::size_t count = std::distance(first, last);
+			Notifier notifier;
+			int index = -1;
+
+			if (count) {
+				const std::size_t start = rotation++ % count;
+				for (std::size_t i = 0; i < count; i++) {
+					std::size_t pos = (start + i) % count;
+					if ((**std::next(first, pos))->attach(&notifier, pos))
+						notifier.notify(pos);
+				}
+				index = notifier.wait(ttd);
+				for (Iter iter = first; iter != last; iter++)
+					(**iter)->detach(&notifier);
+			}
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("select", index < 0 ? "timed out" : "mailbox #%d ready", index);
+#endif
+			if (status) *status = index < 0 ? TIMEOUT : SUCCESS;
+			return index;
+		}
+	}
+
+	/**
+	 * Blocks until any of the given mailboxes holds a message or ttd passes (0ms => wait forever).
+	 * Ready mailboxes are reported in order of arrival, and mailboxes that were already ready
+	 * on entry take turns between calls. Message is not taken, call get on the reported mailbox.
+	 * @return int Index of the ready mailbox in the passed list, -1 on timeout
+	 */
+	template <class T>
+	int select(std::initializer_list<MonitorMessageBox<T>*> boxes, const duration_t& ttd = 0ms, status_t* status = nullptr) {
+		return impl::select(boxes.begin(), boxes.end(), ttd, status);
+	}
+	template <class T>
+	int select(const std::vector<MonitorMessageBox<T>*>& boxes, const duration_t& ttd = 0ms, status_t* status = nullptr) {
+		return impl::select(boxes.begin(), boxes.end(), ttd, status);
+	}
+
+	/**
+	 * Request/reply channel in which clients share one request mailbox and receive replies through
+	 * pooled slots instead of mailboxes of their own. Every call takes a free slot (pool grows on demand),
+	 * and correlation id of the request names the slot together with its generation, so replies to
+	 * slots that were already reused are rejected. Server may reply in any order and at any later time.
+	 */
+	template <class Req, class Resp>
+	class RpcChannel {
+	public:
+		typedef uint64_t correlation_t;
+		struct Request {
+			correlation_t id;
+			Req payload;
+		};
+	private:
+		struct slot_t {
+			std::promise<Resp> promise;
+			uint32_t generation = 0;
+		};
+
+		MonitorMessageBox<Request> requests;
+		std::mutex mutex; //guards slot pool
+		std::deque<slot_t> slots; //deque keeps slots in place while the pool grows
+		std::vector<uint32_t> free_slots;
+
+		//completes slot's promise with fulfil(promise) and returns the slot to the pool
+		template <typename F>
+		bool complete(correlation_t id, F fulfil) {
+			std::unique_lock<std::mutex> lock(mutex);
+			uint32_t index = static_cast<uint32_t>(id);
+			if (index >= slots.size() || slots[index].generation != static_cast<uint32_t>(id >> 32))
+				return false;
+			slot_t& slot = slots[index];
+			fulfil(slot.promise);
+			slot.generation++;
+			free_slots.push_back(index);
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("RpcChannel(%s)", "replied to slot #%u", requests->name(), index);
+#endif
+			return true;
+		}
+	public:
+		RpcChannel(uint capacity = 10, const char* name = "") : requests(capacity, name) {}
+
+		/**
+		 * Sends request to the server, future becomes ready when the server replies to it
+		 */
+		std::future<Resp> call(const Req& payload, priority_t p = MEDIUM) {
+			correlation_t id;
+			std::future<Resp> future;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				uint32_t index;
+				if (free_slots.empty()) {
+					index = static_cast<uint32_t>(slots.size());
+					slots.emplace_back();
+				}
+				else {
+					index = free_slots.back();
+					free_slots.pop_back();
+				}
+				slot_t& slot = slots[index];
+				slot.promise = std::promise<Resp>();
+				future = slot.promise.get_future();
+				id = static_cast<correlation_t>(slot.generation) << 32 | index;
+			}
+			requests->put(Request{ id, payload }, p);
+			return future;
+		}
+		/**
+		 * Takes next request, timeouts and expiration are reported the same way as with MessageBox::get
+		 */
+		Request receive(const duration_t& ttd = 0ms, status_t* status = nullptr) {
+			return requests->get(ttd, status);
+		}
+		/**
+		 * Completes request with given correlation id and returns its slot to the pool
+		 * @return bool false if the id is unknown or was already replied to
+		 */
+		bool reply(correlation_t id, const Resp& response) {
+			return complete(id, [&](std::promise<Resp>& promise) { promise.set_value(response); });
+		}
 		/**
-		 * Each Monitorable object has its own condition_generator that
-		 * contains reference to its mutex and serves to deliver it to
-		 * condition variables when they are constructed
+		 * Same as reply, but the caller's future rethrows error instead of returning a response
+		 * @return bool false if the id is unknown or was already replied to
 		 */
-		class condition_generator {
-			mutex_t* monitor_mutex = nullptr;
-			void set_mutex(mutex_t* mutex) {
-				monitor_mutex = mutex;
+		bool reply_error(correlation_t id, std::exception_ptr error) {
+			return complete(id, [&](std::promise<Resp>& promise) { promise.set_exception(error); });
+		}
+		/**
+		 * Receives one request and replies with the value handler returns for its payload.
+		 * Exception thrown by handler is passed on to the caller through reply_error.
+		 */
+		template <typename F>
+		bool serve(F handler, const duration_t& ttd = 0ms, status_t* status = nullptr) {
+			status_t result;
+			Request request = receive(ttd, &result);
+			if (status) *status = result;
+			if (result != SUCCESS)
+				return false;
+			try {
+				return reply(request.id, handler(request.payload));
 			}
-		public:
-			cond operator()(const char* name = "") {
-				return cond(monitor_mutex, name);
+			catch (...) {
+				return reply_error(request.id, std::current_exception());
 			}
-			template<class T>
-			friend class Monitor;
-		};
-		condition_generator cond_gen;
-	public:
-		template<class T>
-		friend class Monitor;
+		}
+		/**
+		 * Number of reply slots allocated so far, which is the peak number of concurrent calls
+		 */
+		std::size_t pool_size() {
+			std::unique_lock<std::mutex> lock(mutex);
+			return slots.size();
+		}
 	};
 
+#if defined(__linux__) && defined(CDPL_IPC)
+	/**
+	 * Mailbox placed in named POSIX shared memory, usable from any process that opens it by the same name.
+	 * Messages are kept in a ring of fixed capacity and copied bytewise, thus T must be trivially copyable.
+	 * First instance to open the name creates and initializes the ring, the others attach to it.
+	 * Name is removed when the creating instance is destroyed in the creating process.
+	 * Attaching throws std::system_error if the creator doesn't finish initializing within 5 seconds,
+	 * e.g. because it died, such stale name has to be removed with shm_unlink.
+	 * Linux only, compiled in with CDPL_IPC defined before including the library.
+	 */
 	template <class T>
-	class Monitor {
-		static_assert(std::is_base_of<Monitorable, T>::value, "T must inherit from Monitorable");
-	protected:
-		mutex_t mutex; //monitor's mutex
-		T obj; //hidden Monitorable object which methods will be called
+	class SharedMemoryMessageBox : public MessageBox<T> {
+		static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable to be placed in shared memory");
+
+		struct slot_t {
+			T message;
+			priority_t p;
+			duration_t::rep ttl;
+			std::chrono::steady_clock::rep ts;
+		};
+		struct header_t {
+			std::atomic<uint32_t> ready;
+			pthread_mutex_t mutex;
+			pthread_cond_t notFull;
+			pthread_cond_t notEmpty;
+			uint capacity;
+			uint head;
+			uint count;
+			//get closing the gap left by taken message: ring offset still to be filled plus one, 0 when idle.
+			//Lets the next lock holder finish it when the process dies midway
+			std::atomic<uint32_t> shift;
+			uint next_head;
+			uint next_count;
+		};
+		static constexpr std::size_t slots_offset = (sizeof(header_t) + alignof(slot_t) - 1) / alignof(slot_t) * alignof(slot_t);
+
+		header_t* header = nullptr;
+		slot_t* slots = nullptr;
+		std::size_t length = 0;
+		std::string m_name;
+		pid_t creator = 0;
+
+		void map(int fd, std::size_t size) {
+			void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (addr == MAP_FAILED) {
+				int err = errno;
+				close(fd);
+				throw std::system_error(err, std::generic_category(), "mmap");
+			}
+			close(fd);
+			length = size;
+			header = static_cast<header_t*>(addr);
+			slots = reinterpret_cast<slot_t*>(static_cast<char*>(addr) + slots_offset);
+		}
+		void create(int fd, uint capacity) {
+			std::size_t size = slots_offset + capacity * sizeof(slot_t);
+			if (ftruncate(fd, size) != 0) {
+				int err = errno;
+				close(fd);
+				shm_unlink(m_name.c_str());
+				throw std::system_error(err, std::generic_category(), "ftruncate");
+			}
+			map(fd, size);
+
+			pthread_mutexattr_t mutex_attr;
+			pthread_mutexattr_init(&mutex_attr);
+			pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+			pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+			pthread_mutex_init(&header->mutex, &mutex_attr);
+			pthread_mutexattr_destroy(&mutex_attr);
+
+			pthread_condattr_t cond_attr;
+			pthread_condattr_init(&cond_attr);
+			pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+			pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+			pthread_cond_init(&header->notFull, &cond_attr);
+			pthread_cond_init(&header->notEmpty, &cond_attr);
+			pthread_condattr_destroy(&cond_attr);
+
+			header->capacity = capacity;
+			header->head = header->count = 0;
+			header->shift.store(0);
+			header->ready.store(1, std::memory_order_release);
+			creator = getpid();
+		}
+		void attach(int fd) {
+			//creator that died or failed before finishing would leave attaching processes waiting forever
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			struct stat info;
+			//creator might not have sized the object yet
+			while (true) {
+				if (fstat(fd, &info) != 0) {
+					int err = errno;
+					close(fd);
+					throw std::system_error(err, std::generic_category(), "fstat");
+				}
+				if (info.st_size != 0)
+					break;
+				if (std::chrono::steady_clock::now() >= deadline) {
+					close(fd);
+					throw std::system_error(ETIMEDOUT, std::generic_category(), "SharedMemoryMessageBox: " + m_name + " was never sized by its creator");
+				}
+				std::this_thread::sleep_for(1ms);
+			}
+			map(fd, info.st_size);
+			while (!header->ready.load(std::memory_order_acquire)) {
+				if (std::chrono::steady_clock::now() >= deadline) {
+					munmap(header, length);
+					throw std::system_error(ETIMEDOUT, std::generic_category(), "SharedMemoryMessageBox: " + m_name + " was never initialized by its creator");
+				}
+				std::this_thread::sleep_for(1ms);
+			}
+		}
+		//shifts messages older than the taken one a slot up, one by one, then drops the head.
+		//Each step is recorded in header before the next one, so it can be resumed after a crash
+		void finish_removal() {
+			const uint capacity = header->capacity;
+			for (uint32_t k; (k = header->shift.load(std::memory_order_relaxed)) > 1;) {
+				slots[(header->head + k - 1) % capacity] = slots[(header->head + k - 2) % capacity];
+				header->shift.store(k - 1, std::memory_order_release);
+			}
+			header->head = header->next_head;
+			header->count = header->next_count;
+			header->shift.store(0, std::memory_order_release);
+		}
+		//process holding the lock died, finishes removal it might have been doing
+		void recover() {
+			if (header->shift.load() != 0)
+				finish_removal();
+			pthread_mutex_consistent(&header->mutex);
+		}
 
+		void lock() {
+			if (pthread_mutex_lock(&header->mutex) == EOWNERDEAD)
+				recover();
+		}
+		void unlock() {
+			pthread_mutex_unlock(&header->mutex);
+		}
 		/**
-		 * Helper class that effectively locks and unlocks the mutex on function call.
-		 * This is achieved in RAII fashion, as temporary helper object gets constructed
-		 * (thus acquiring mutex) when overloaded operator-> gets called, and immediately
-		 * after function call gets destroyed (thus releasing mutex).
+		 * Waits on cond until it is signalled or deadline passes, deadline of zero means no timeout
+		 * @return bool false if deadline passed
 		 */
-		class helper {
-			Monitor* mon;
-		public:
-			helper(Monitor* mon) :mon(mon) {
-#ifdef DEBUG_MONITOR
-				DEBUG_WRITE("monitor", "trying to lock");
+		bool wait(pthread_cond_t* cond, const timespec& deadline) {
+			int rc = deadline.tv_sec || deadline.tv_nsec ? pthread_cond_timedwait(cond, &header->mutex, &deadline) : pthread_cond_wait(cond, &header->mutex);
+			if (rc == EOWNERDEAD)
+				recover();
+			return rc != ETIMEDOUT;
+		}
+		static timespec deadline_after(const duration_t& ttd) {
+			timespec deadline{ 0, 0 };
+			if (ttd != 0ms) {
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				auto ns = deadline.tv_nsec + std::chrono::duration_cast<std::chrono::nanoseconds>(ttd).count();
+				deadline.tv_sec += ns / 1000000000;
+				deadline.tv_nsec = ns % 1000000000;
+			}
+			return deadline;
+		}
+	public:
+		SharedMemoryMessageBox(const char* name, uint capacity = 10) : m_name(name) {
+			int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (fd >= 0)
+				create(fd, capacity);
+			else if (errno == EEXIST && (fd = shm_open(name, O_RDWR, 0600)) >= 0)
+				attach(fd);
+			else
+				throw std::system_error(errno, std::generic_category(), "shm_open");
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("SharedMemoryMessageBox(%s)", creator ? "created" : "attached", name);
 #endif
-				mon->mutex.lock();
-#ifdef DEBUG_MONITOR
-				DEBUG_WRITE("monitor", "locking");
+		}
+		SharedMemoryMessageBox(const SharedMemoryMessageBox&) = delete;
+		SharedMemoryMessageBox& operator=(const SharedMemoryMessageBox&) = delete;
+		~SharedMemoryMessageBox() {
+			munmap(header, length);
+			if (creator == getpid())
+				shm_unlink(m_name.c_str());
+		}
+
+		void put(const T& message, priority_t p = MEDIUM, const duration_t& ttl = 0ms) override {
+			lock();
+			while (header->count == header->capacity)
+				wait(&header->notFull, timespec{ 0, 0 });
+			slot_t& slot = slots[(header->head + header->count) % header->capacity];
+			slot.message = message;
+			slot.p = p;
+			slot.ttl = ttl.count();
+			slot.ts = std::chrono::steady_clock::now().time_since_epoch().count();
+			std::atomic_signal_fence(std::memory_order_release); //message is complete before it is counted
+			header->count++;
+			pthread_cond_signal(&header->notEmpty);
+			unlock();
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("SharedMemoryMessageBox(%s)", "message put", m_name.c_str());
 #endif
-			}
-			~helper() {
-				mon->mutex.unlock();
-#ifdef DEBUG_MONITOR
-				DEBUG_WRITE("monitor", "unlocking");
+		}
+		T get(const duration_t& ttd = 0ms, status_t* status = nullptr) override {
+			timespec deadline = deadline_after(ttd);
+			lock();
+			while (header->count == 0) {
+				if (!wait(&header->notEmpty, deadline)) {
+					unlock();
+#ifdef DEBUG_MPI
+					DEBUG_WRITE("SharedMemoryMessageBox(%s)", "message timed out", m_name.c_str());
 #endif
+					if (status) *status = TIMEOUT;
+					return T();
+				}
 			}
-			/**
-			 * Nifty hack to insert underlying object and create illusion of direct access
-			 */
-			T* operator->() { return &mon->obj; }
-		};
+			//highest priority wins, ring order keeps messages of equal priority FIFO
+			const uint capacity = header->capacity;
+			uint best = 0;
+			for (uint i = 1; i < header->count; i++)
+				if (slots[(header->head + i) % capacity].p < slots[(header->head + best) % capacity].p)
+					best = i;
+			slot_t slot = slots[(header->head + best) % capacity];
+			header->next_head = (header->head + 1) % capacity;
+			header->next_count = header->count - 1;
+			header->shift.store(best + 1, std::memory_order_release);
+			finish_removal();
+			pthread_cond_signal(&header->notFull);
+			unlock();
 
-	public:
-		template <typename ...Args>
-		Monitor(Args&&... args) :obj(std::forward<Args>(args)...) {
-			static_cast<Monitorable&>(obj).cond_gen.set_mutex(&mutex);
-#ifdef DEBUG_MONITOR
-			DEBUG_WRITE("monitor", "created");
+			auto age = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(slot.ts);
+			if (slot.ttl != 0 && age > duration_t(slot.ttl)) {
+#ifdef DEBUG_MPI
+				DEBUG_WRITE("SharedMemoryMessageBox(%s)", "message expired", m_name.c_str());
+#endif
+				if (status) *status = EXPIRED;
+				return T();
+			}
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("SharedMemoryMessageBox(%s)", "message recieved", m_name.c_str());
 #endif
+			if (status) *status = SUCCESS;
+			return slot.message;
 		}
-		/**
-		 * Call underlying object's function in mutually exclusive way.
-		 */
-		helper operator->() { return helper(this); }
-		/**
-		 * Returns demonitorized object. Use with caution as locking on condition
-		 * from underlying Monitorable object will lead to deadlock.
-		 */
-		T& operator*() { return obj; }
+		const char* name() const { return m_name.c_str(); }
 	};
 
-	template<typename T> using monitor = Monitor<T>;
-}
-
-namespace MPI {
-	using namespace std::chrono_literals;
-	typedef uint_fast32_t priority_t;
-	typedef uint_fast8_t status_t;
-	typedef unsigned int uint;
-	typedef std::chrono::duration<long, std::milli> duration_t;
-	typedef std::chrono::time_point< std::chrono::high_resolution_clock > timestamp_t;
-
-	enum { VERY_HIGH, HIGH, MEDIUM, LOW, VERY_LOW };
-	enum { SUCCESS, TIMEOUT, EXPIRED };
-
+	/**
+	 * Serializer that copies object representation, used by default for trivially copyable types
+	 */
 	template <class T>
-	class MessageBox {
-	public:
-		virtual void put(const T& message, priority_t p, const duration_t& ttl) = 0;
-		virtual T get(const duration_t& ttd, status_t* status) = 0;
+	struct TrivialSerializer {
+		static std::string serialize(const T& message) {
+			return std::string(reinterpret_cast<const char*>(&message), sizeof(T));
+		}
+		static T deserialize(const std::string& data) {
+			T message;
+			std::memcpy(&message, data.data(), std::min(data.size(), sizeof(T)));
+			return message;
+		}
 	};
+	/**
+	 * Serializer that relies on stream operators << and >> being overloaded for T
+	 */
 	template <class T>
-	class MonitorableMessageBox : public MessageBox<T>, public Concurrent::Monitorable {
-		cond notFull = cond_gen();
-		cond notEmpty = cond_gen();
+	struct StreamSerializer {
+		static std::string serialize(const T& message) {
+			std::ostringstream oss;
+			oss << message;
+			return oss.str();
+		}
+		static T deserialize(const std::string& data) {
+			std::istringstream iss(data);
+			T message;
+			iss >> message;
+			return message;
+		}
+	};
+	template <class T>
+	using default_serializer_t = std::conditional_t<std::is_trivially_copyable<T>::value, TrivialSerializer<T>, StreamSerializer<T>>;
 
-		uint capacity;
+	enum socket_role_t { OWNER, PEER };
 
+	/**
+	 * Mailbox bound to Unix domain datagram socket at given path. OWNER binds the path and is the only one
+	 * that can get, while every PEER (in this or any other process) puts into it. Messages are converted
+	 * with Serializer, which must provide static std::string serialize(const T&) and T deserialize(const std::string&).
+	 * Capacity is bounded by socket's receive buffer, put blocks while it is full.
+	 * Linux only, compiled in with CDPL_IPC defined before including the library.
+	 */
+	template <class T, class Serializer = default_serializer_t<T>>
+	class SocketMessageBox : public MessageBox<T> {
+		struct wire_header_t {
+			priority_t p;
+			duration_t::rep ttl;
+			std::chrono::steady_clock::rep ts;
+		};
 		struct MessageWrap {
 			T message;
 			priority_t p;
-			duration_t ttl;
-			timestamp_t ts;
-			MessageWrap(const T& message, priority_t p, const duration_t& ttl) :message(message), p(p), ttl(ttl), ts(std::chrono::high_resolution_clock::now()) {}
-			friend bool operator>(const MessageWrap& mw1, const MessageWrap& mw2) { return mw1.p > mw2.p; }
+			duration_t::rep ttl;
+			std::chrono::steady_clock::rep ts;
+			uint64_t seq;
+			friend bool operator>(const MessageWrap& mw1, const MessageWrap& mw2) { return mw1.p != mw2.p ? mw1.p > mw2.p : mw1.seq > mw2.seq; }
 		};
 
-		typedef std::priority_queue<MessageWrap, std::vector<MessageWrap>, std::greater<MessageWrap>> buffer_t;
-		buffer_t buffer;
-		const char* m_name;
+		int fd;
+		sockaddr_un address;
+		socket_role_t role;
+		pid_t creator;
+		std::string m_name;
+
+		std::mutex mutex; //guards received messages that were not taken yet
+		std::priority_queue<MessageWrap, std::vector<MessageWrap>, std::greater<MessageWrap>> pending;
+		uint64_t next_seq = 0;
+
+		//moves every datagram that already arrived into pending queue, called with mutex held
+		void drain() {
+			std::string data;
+			while (true) {
+				ssize_t size = recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+				if (size < 0)
+					break;
+				data.resize(size);
+				size = recv(fd, &data[0], data.size(), MSG_DONTWAIT);
+				if (size < static_cast<ssize_t>(sizeof(wire_header_t)))
+					continue;
+				wire_header_t header;
+				std::memcpy(&header, data.data(), sizeof(header));
+				pending.push(MessageWrap{ Serializer::deserialize(data.substr(sizeof(header))), header.p, header.ttl, header.ts, next_seq++ });
+			}
+		}
 	public:
-		MonitorableMessageBox(uint capacity = 10, const char* name = "") : capacity(capacity), m_name(name) {}
+		SocketMessageBox(const char* path, socket_role_t role = PEER) : role(role), creator(getpid()), m_name(path) {
+			if (std::strlen(path) >= sizeof(address.sun_path))
+				throw std::invalid_argument("SocketMessageBox: socket path too long");
+			std::memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			std::strcpy(address.sun_path, path);
+
+			fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+			if (fd < 0)
+				throw std::system_error(errno, std::generic_category(), "socket");
+			if (role == OWNER) {
+				unlink(path); //remove stale socket left by previous owner
+				if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+					int err = errno;
+					close(fd);
+					throw std::system_error(err, std::generic_category(), "bind");
+				}
+			}
+#ifdef DEBUG_MPI
+			DEBUG_WRITE("SocketMessageBox(%s)", role == OWNER ? "bound" : "created", path);
+#endif
+		}
+		SocketMessageBox(const SocketMessageBox&) = delete;
+		SocketMessageBox& operator=(const SocketMessageBox&) = delete;
+		~SocketMessageBox() {
+			close(fd);
+			if (role == OWNER && creator == getpid())
+				unlink(m_name.c_str());
+		}
+
 		void put(const T& message, priority_t p = MEDIUM, const duration_t& ttl = 0ms) override {
-			while (buffer.size() == capacity)
-				notFull.wait();
-			buffer.emplace(message, p, ttl);
-			notEmpty.signal();
+			wire_header_t header{ p, ttl.count(), std::chrono::steady_clock::now().time_since_epoch().count() };
+			std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+			data += Serializer::serialize(message);
+			while (sendto(fd, data.data(), data.size(), 0, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+				if (errno != EINTR)
+					throw std::system_error(errno, std::generic_category(), "sendto");
+			}
 #ifdef DEBUG_MPI
-			DEBUG_WRITE("MessageBox(%s)", "message put", m_name);
+			DEBUG_WRITE("SocketMessageBox(%s)", "message put", m_name.c_str());
 #endif
 		}
 		T get(const duration_t& ttd = 0ms, status_t* status = nullptr) override {
-			auto canContinue = std::make_shared<cond>(cond(cond_gen()));
-			if (ttd != 0ms) {
-				std::thread([](std::shared_ptr<cond> canContinue, const duration_t& ttd) {
-					std::this_thread::sleep_for(ttd);
-					//TODO: discuss whether to add safety check that user has locked on canContinue before reaching this step (only possible if ttd is ridiculously small)
-					canContinue->signal();
-				}, canContinue, ttd).detach();
-			}
-			//safe to use rawe pointers because if monitor gets destroyed unwantingly, this won't be released anyway so there will be memory leak
-			//TODO: discuss whether to save the user from leakage
-			std::thread([](std::shared_ptr<cond> canContinue, buffer_t* buffer, cond* notEmpty) {
-				while (buffer->size() == 0)
-					notEmpty->wait();
-				canContinue->signal();
-			}, canContinue, &buffer, &notEmpty).detach();
-
-			canContinue->wait();
-			if (buffer.size()) {
-				auto msg_wrap = buffer.top();
-				buffer.pop();
-				notFull.signal();
-
-				if (msg_wrap.ttl == 0ms || std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - msg_wrap.ts).count() > 0) {
+			if (role != OWNER)
+				throw std::logic_error("SocketMessageBox: only OWNER can get messages");
+			auto deadline = std::chrono::steady_clock::now() + ttd;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					drain();
+					if (!pending.empty()) {
+						MessageWrap msg_wrap = pending.top();
+						pending.pop();
+						lock.unlock();
+
+						auto age = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(msg_wrap.ts);
+						if (msg_wrap.ttl != 0 && age > duration_t(msg_wrap.ttl)) {
 #ifdef DEBUG_MPI
-					DEBUG_WRITE("MessageBox(%s)", "message recieved", m_name);
+							DEBUG_WRITE("SocketMessageBox(%s)", "message expired", m_name.c_str());
 #endif
-					if (status) *status = SUCCESS;
-					return msg_wrap.message;
-				}
-				else {
+							if (status) *status = EXPIRED;
+							return T();
+						}
 #ifdef DEBUG_MPI
-					DEBUG_WRITE("MessageBox(%s)", "message expired", m_name);
+						DEBUG_WRITE("SocketMessageBox(%s)", "message recieved", m_name.c_str());
 #endif
-					if (status) *status = EXPIRED;
+						if (status) *status = SUCCESS;
+						return msg_wrap.message;
+					}
 				}
-			}
-			else { //released on timeout
+				int timeout = -1;
+				if (ttd != 0ms) {
+					auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+					if (remaining <= 0ms) {
 #ifdef DEBUG_MPI
-				DEBUG_WRITE("MessageBox(%s)", "message timed out", m_name);
+						DEBUG_WRITE("SocketMessageBox(%s)", "message timed out", m_name.c_str());
 #endif
-				if (status) *status = TIMEOUT;
+						if (status) *status = TIMEOUT;
+						return T();
+					}
+					timeout = static_cast<int>(remaining.count()) + 1;
+				}
+				pollfd pfd{ fd, POLLIN, 0 };
+				poll(&pfd, 1, timeout);
 			}
-			return T(); //TODO: discuss whether it is better to enforce the user to overload cast operator or to have specific constructor if this fails or to leave it like this
 		}
-		const char* name() const { return m_name; }
+		const char* name() const { return m_name.c_str(); }
 	};
+#endif //CDPL_IPC
 
-	template<typename T> using MonitorMessageBox = Concurrent::monitor<MonitorableMessageBox<T>>;
+	/**
+	 * Unit in which communicator carries values between ranks
+	 */
+	template <class T>
+	struct Envelope {
+		uint source; //rank that sent the envelope
+		uint tag;    //user tag for point-to-point messages, sequence number of collective operation otherwise
+		uint index;  //rank the value belongs to, needed when values are forwarded along the tree
+		T value;
+	};
+
+	/**
+	 * Group of ranks, each owning one mailbox, that communicate point-to-point or collectively.
+	 * Collectives run over binomial trees so that every operation finishes in log2(size) rounds
+	 * and no rank sends more than log2(size) envelopes except when forwarding gathered/scattered values.
+	 * Box can be any mailbox used through operator-> (MonitorMessageBox for threads, SharedMemoryMessageBox
+	 * or SocketMessageBox for processes) carrying Envelope<T>. Scatter, gather and barrier
+	 * additionally need T to be default constructible.
+	 */
+	template <class T, class Box = MonitorMessageBox<Envelope<T>>>
+	class Communicator {
+	public:
+		typedef Envelope<T> envelope_t;
+	private:
+		static constexpr uint collective_tag = 1u << 31;
+
+		std::vector<std::unique_ptr<Box>> owned;
+		std::vector<Box*> boxes;
+	public:
+		/**
+		 * Creates group of given size with in-process mailboxes of given capacity
+		 */
+		Communicator(uint size, uint capacity = 10) {
+			for (uint i = 0; i < size; i++) {
+				owned.emplace_back(new Box(capacity));
+				boxes.push_back(owned.back().get());
+			}
+		}
+		/**
+		 * Creates group over mailboxes owned by the caller, i-th mailbox belongs to rank i
+		 */
+		Communicator(const std::vector<Box*>& boxes) : boxes(boxes) {}
+
+		uint size() const { return static_cast<uint>(boxes.size()); }
+
+		/**
+		 * Handle through which one rank takes part in communication. Each rank has to be driven by a single
+		 * thread (or process) and all ranks have to call collective operations in the same order.
+		 * Associative and commutative operations are expected for reduce and allreduce.
+		 */
+		class Rank {
+			Communicator* comm;
+			uint me;
+			uint sequence = 0;
+			std::list<envelope_t> stash; //envelopes that arrived before they were asked for
+
+			uint relative(uint rank, uint root) const { return (rank + comm->size() - root) % comm->size(); }
+			uint absolute(uint rank, uint root) const { return (rank + root) % comm->size(); }
+
+			void send_envelope(uint dest, uint tag, uint index, const T& value) {
+				(*comm->boxes[dest])->put(envelope_t{ me, tag, index, value });
+			}
+			envelope_t recv_envelope(uint source, uint tag) {
+				for (auto iter = stash.begin(); iter != stash.end(); iter++) {
+					if (iter->source == source && iter->tag == tag) {
+						envelope_t envelope = *iter;
+						stash.erase(iter);
+						return envelope;
+					}
+				}
+				while (true) {
+					envelope_t envelope = (*comm->boxes[me])->get();
+					if (envelope.source == source && envelope.tag == tag)
+						return envelope;
+					stash.push_back(envelope);
+				}
+			}
+			uint next_tag() { return collective_tag | (sequence++ & (collective_tag - 1)); }
+			//smallest power of two not less than size, first mask a root sends with
+			uint top_mask() const {
+				uint mask = 1;
+				while (mask < comm->size()) mask <<= 1;
+				return mask;
+			}
+			//number of ranks in the subtree rooted at relative rank vr, that is entered with given mask
+			uint subtree(uint vr, uint mask) const { return std::min(mask, comm->size() - vr); }
+		public:
+			Rank(Communicator* comm, uint me) : comm(comm), me(me) {}
+			uint id() const { return me; }
+			uint size() const { return comm->size(); }
+
+			void send(uint dest, const T& value, uint tag = 0) {
+				send_envelope(dest, tag & ~collective_tag, me, value);
+			}
+			T recv(uint source, uint tag = 0) {
+				return recv_envelope(source, tag & ~collective_tag).value;
+			}
+
+			/**
+			 * Value of root is delivered to every rank
+			 */
+			T broadcast(const T& value, uint root = 0) {
+				const uint tag = next_tag(), vr = relative(me, root);
+				T result = value;
+				uint mask = 1;
+				for (; mask < size(); mask <<= 1) {
+					if (vr & mask) {
+						result = recv_envelope(absolute(vr - mask, root), tag).value;
+						break;
+					}
+				}
+				for (mask >>= 1; mask > 0; mask >>= 1)
+					if (vr + mask < size())
+						send_envelope(absolute(vr + mask, root), tag, me, result);
+				return result;
+			}
+			/**
+			 * i-th value of root is delivered to rank i, values are ignored on other ranks.
+			 * Throws std::invalid_argument on root if values has fewer than size() elements.
+			 */
+			T scatter(const std::vector<T>& values, uint root = 0) {
+				if (me == root && values.size() < size())
+					throw std::invalid_argument("Communicator::Rank::scatter: root needs a value for every rank");
+				const uint tag = next_tag(), vr = relative(me, root);
+				std::vector<T> held(size()); //indexed by relative rank, only own subtree is filled
+				uint mask;
+				if (vr == 0) {
+					for (uint i = 0; i < size(); i++)
+						held[i] = values[absolute(i, root)];
+					mask = top_mask();
+				}
+				else {
+					mask = vr & (~vr + 1);
+					for (uint i = subtree(vr, mask); i > 0; i--) {
+						envelope_t envelope = recv_envelope(absolute(vr - mask, root), tag);
+						held[relative(envelope.index, root)] = envelope.value;
+					}
+				}
+				for (mask >>= 1; mask > 0; mask >>= 1) {
+					if (vr + mask < size()) {
+						for (uint i = vr + mask; i < vr + mask + subtree(vr + mask, mask); i++)
+							send_envelope(absolute(vr + mask, root), tag, absolute(i, root), held[i]);
+					}
+				}
+				return held[vr];
+			}
+			/**
+			 * Values of all ranks are collected at root, i-th element holding value of rank i.
+			 * Other ranks receive empty vector.
+			 */
+			std::vector<T> gather(const T& value, uint root = 0) {
+				const uint tag = next_tag(), vr = relative(me, root);
+				std::vector<envelope_t> held{ envelope_t{ me, tag, me, value } };
+				for (uint mask = 1; mask < size(); mask <<= 1) {
+					if (vr & mask) {
+						for (const envelope_t& envelope : held)
+							send_envelope(absolute(vr - mask, root), tag, envelope.index, envelope.value);
+						return std::vector<T>();
+					}
+					if (vr + mask < size()) {
+						for (uint i = subtree(vr + mask, mask); i > 0; i--)
+							held.push_back(recv_envelope(absolute(vr + mask, root), tag));
+					}
+				}
+				std::vector<T> result(size());
+				for (const envelope_t& envelope : held)
+					result[envelope.index] = envelope.value;
+				return result;
+			}
+			/**
+			 * Values of all ranks are combined with op, result is meaningful only at root
+			 */
+			template <typename Op>
+			T reduce(const T& value, Op op, uint root = 0) {
+				const uint tag = next_tag(), vr = relative(me, root);
+				T result = value;
+				for (uint mask = 1; mask < size(); mask <<= 1) {
+					if (vr & mask) {
+						send_envelope(absolute(vr - mask, root), tag, me, result);
+						break;
+					}
+					if (vr + mask < size())
+						result = op(result, recv_envelope(absolute(vr + mask, root), tag).value);
+				}
+				return result;
+			}
+			/**
+			 * Values of all ranks are combined with op and the result is delivered to every rank
+			 */
+			template <typename Op>
+			T allreduce(const T& value, Op op) {
+				return broadcast(reduce(value, op));
+			}
+			/**
+			 * Blocks until every rank reaches the barrier. Envelopes always carry a T,
+			 * so it sends default constructed values and needs T to be default constructible.
+			 */
+			void barrier() {
+				broadcast(reduce(T(), [](const T& first, const T&) { return first; }));
+			}
+		};
+
+		Rank rank(uint id) { return Rank(this, id); }
+	};
 }
 
 namespace Linda {
@@ -898,7 +5971,7 @@ namespace Linda {
 		}
 
 		template <typename ...Args>
-		inline void eval(Args... args) {
+		inline Concurrent::Future<void> eval(Args... args) {
 			using tuple_t = std::tuple<Args...>;
 			using pattern_t = tuple_cat_t<std::tuple<return_type<Args>>...>;
 
@@ -907,14 +5980,19 @@ namespace Linda {
 				map[typeid(pattern_t)] = static_cast<void*>(new tm_vec_t<pattern_t>);
 			map_mutex.unlock();
 
+			Concurrent::Promise<void> placed;
+			Concurrent::Future<void> result = placed.get_future();
 			std::thread m_thread(
-				run_active_tuple<tuple_t, pattern_t, tm_vec_t<pattern_t> >,
+				[placed = std::move(placed)](tuple_t tuple, tm_vec_t<pattern_t>* tm_vec) mutable {
+					auto call = [&] { run_active_tuple(tuple, pattern_t(), tm_vec); };
+					Concurrent::impl::fulfil_t<void>::call(placed, call);
+				},
 				tuple_t(std::forward<Args>(args)...),
-				pattern_t(),
 				static_cast<tm_vec_t<pattern_t>*>(map[typeid(pattern_t)])
 			);
 
 			m_thread.detach();
+			return result;
 		}
 
 	}
@@ -944,9 +6022,12 @@ namespace Linda {
 		return impl::in(impl::on_found_t::REMOVE, impl::on_notfound_t::RETURN, std::forward<Args>(args)...);
 	}
 
+	/**
+	 * @return Future<void> ready once evaluated tuple is placed in tuple space
+	 */
 	template <typename ...Args>
-	void eval(Args&&... args) {
-		impl::eval(std::forward<Args>(args)...);
+	Concurrent::Future<void> eval(Args&&... args) {
+		return impl::eval(std::forward<Args>(args)...);
 	}
 };
 namespace Testbed {
@@ -990,11 +6071,21 @@ namespace Testbed {
 		std::default_random_engine random_engine;
 		std::uniform_int_distribution<uint> random_generator;
 		std::shared_ptr<GeneratorInterface> generator;
+		options_t thread_options;
+		FiberScheduler* scheduler = nullptr;
 
 		void run() {
 			while (true) {
 				sleep_for(std::chrono::milliseconds(random_generator(random_engine)));
-				generator->generate()->start();
+				Thread* thread = generator->generate();
+#ifdef __linux__
+				if (scheduler) {
+					scheduler->launch(*thread);
+					continue;
+				}
+#endif
+				thread->set_options(thread_options);
+				thread->start();
 			}
 		}
 	public:
@@ -1006,13 +6097,26 @@ namespace Testbed {
 			seed_offset += seed_increment;
 		}
 		ThreadGenerator(const ThreadGenerator& rhs)
-			: Thread("generator"), random_engine(random_seed + seed_offset), random_generator(rhs.random_generator), generator(rhs.generator)
+			: Thread("generator"), random_engine(random_seed + seed_offset), random_generator(rhs.random_generator), generator(rhs.generator),
+			  thread_options(rhs.thread_options), scheduler(rhs.scheduler)
 		{
 			seed_offset += seed_increment;
 		}
 		~ThreadGenerator() {
 			join();
 		}
+		/**
+		 * Placement and scheduling policy that generated threads start with, set before start()
+		 */
+		void set_thread_options(const options_t& options) {
+			thread_options = options;
+		}
+		/**
+		 * Runs generated threads as fibers of scheduler instead of starting them, set before start()
+		 */
+		void set_scheduler(FiberScheduler* scheduler) {
+			this->scheduler = scheduler;
+		}
 	};
 
 
@@ -0,0 +1,94 @@
+/*
+	This example is part of Concurrent and Distributed Programming Library for C++
+	Copyright (C) 2019 Aleksa Ilic <aleksa.d.ilic@gmail.com>
+
+	This Source Code Form is subject to the terms of the Mozilla Public
+	License, v. 2.0. If a copy of the MPL was not distributed with this
+	file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+	..............................................................................
+
+	Producer-consumer throughput: the monitor ring buffer from
+	examples/concurrent/FIFO-buffer versus Channel, with single item and
+	batched transfers. Numbers are nanoseconds per transferred item, so lower
+	is better.
+*/
+
+#include "CDPL.h"
+
+using namespace Concurrent;
+
+constexpr long items = 1000000;
+constexpr uint capacity = 256;
+constexpr int num_of_producers = 2;
+constexpr int num_of_consumers = 2;
+constexpr std::size_t batch_size = 32;
+
+class Buffer: public Monitorable{
+	std::vector<long> data;
+	uint front = 0, rear = 0, count = 0;
+	cond space_avail = cond_gen("space_avail", STABLE), item_avail = cond_gen("item_avail", STABLE);
+public:
+	Buffer(uint capacity): data(capacity){}
+	void put(long item){
+		while(count == data.size())
+			space_avail.wait();
+		data[rear] = item;
+		rear = (rear + 1) % data.size();
+		count++;
+		item_avail.signal();
+	}
+	long take(){
+		while(count == 0)
+			item_avail.wait();
+		long item = data[front];
+		front = (front + 1) % data.size();
+		count--;
+		space_avail.signal();
+		return item;
+	}
+};
+
+template <typename P, typename C>
+double measure(P&& produce, C&& consume){
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for(int i = 0; i < num_of_producers; i++)
+		threads.emplace_back([&]{ produce(items / num_of_producers); });
+	for(int i = 0; i < num_of_consumers; i++)
+		threads.emplace_back([&]{ consume(items / num_of_consumers); });
+	for(auto& thread: threads)
+		thread.join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / items;
+}
+
+void report(const char* name, double ns){
+	printf("%-40s %10.1f ns/item\n", name, ns);
+}
+
+int main(){
+	monitor<Buffer> buffer(capacity);
+	report("monitor buffer", measure(
+		[&](long n){ for(long i = 0; i < n; i++) buffer->put(i); },
+		[&](long n){ for(long i = 0; i < n; i++) buffer->take(); }));
+
+	Channel<long> channel(capacity);
+	report("Channel push/pop", measure(
+		[&](long n){ for(long i = 0; i < n; i++) channel.push(i); },
+		[&](long n){ long item; for(long i = 0; i < n; i++) channel.pop(item); }));
+
+	Channel<long> batched(capacity);
+	report("Channel batched push/pop", measure(
+		[&](long n){
+			std::vector<long> batch(batch_size);
+			for(long i = 0; i < n; i += batch_size)
+				batched.push(batch.begin(), batch.begin() + std::min<long>(batch_size, n - i));
+		},
+		[&](long n){
+			long batch[batch_size];
+			for(long i = 0; i < n;)
+				i += batched.pop(batch, std::min<long>(batch_size, n - i));
+		}));
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+	This example is part of Concurrent and Distributed Programming Library for C++
+	Copyright (C) 2019 Aleksa Ilic <aleksa.d.ilic@gmail.com>
+
+	This Source Code Form is subject to the terms of the Mozilla Public
+	License, v. 2.0. If a copy of the MPL was not distributed with this
+	file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+	..............................................................................
+
+	False sharing: each thread works only on its own counter, Semaphore or Mutex,
+	but in a plain array neighbours share cache lines and every write invalidates
+	them in the other cores' caches. The same arrays of CachePadded objects keep
+	each one on its own line. Run it with 1, 2, 4, ... threads on a many-core box
+	to see the plain arrays stop scaling. Numbers are nanoseconds per operation,
+	so lower is better.
+*/
+
+#include "CDPL.h"
+#include <cstdlib>
+
+using namespace Concurrent;
+
+constexpr int iterations = 10000000;
+constexpr int max_threads = 64;
+
+template <typename F>
+double measure(int threads, F&& fn){
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for(int t = 0; t < threads; t++)
+		workers.emplace_back([&fn, t]{ for(int i = 0; i < iterations; i++) fn(t); });
+	for(auto& worker: workers)
+		worker.join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+void report(const char* name, int threads, double ns){
+	printf("%-32s %3d threads %10.2f ns/op\n", name, threads, ns);
+}
+
+static std::atomic<long> counters[max_threads];
+static CachePadded<std::atomic<long>> padded_counters[max_threads];
+static sem_t semaphores[max_threads];
+static CachePadded<sem_t> padded_semaphores[max_threads];
+static Mutex mutexes[max_threads];
+static CachePadded<Mutex> padded_mutexes[max_threads];
+
+int main(int argc, char** argv){
+	int threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+	threads = std::max(1, std::min(threads, max_threads));
+
+	report("atomic counter array", threads, measure(threads, [](int t){ counters[t]++; }));
+	report("CachePadded counter array", threads, measure(threads, [](int t){ (*padded_counters[t])++; }));
+	report("Semaphore array", threads, measure(threads, [](int t){ semaphores[t].signal(); semaphores[t].wait(); }));
+	report("CachePadded Semaphore array", threads, measure(threads, [](int t){ padded_semaphores[t]->signal(); padded_semaphores[t]->wait(); }));
+	report("Mutex array", threads, measure(threads, [](int t){ mutexes[t].lock(); mutexes[t].unlock(); }));
+	report("CachePadded Mutex array", threads, measure(threads, [](int t){ padded_mutexes[t]->lock(); padded_mutexes[t]->unlock(); }));
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+	This example is part of Concurrent and Distributed Programming Library for C++
+	Copyright (C) 2019 Aleksa Ilic <aleksa.d.ilic@gmail.com>
+
+	This Source Code Form is subject to the terms of the Mozilla Public
+	License, v. 2.0. If a copy of the MPL was not distributed with this
+	file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+	..............................................................................
+
+	Actors as Threads versus actors as fibers of FiberScheduler: every actor sleeps
+	a bit, then passes a token to its neighbour through a Semaphore a few times.
+	Threads are only run at the smaller count, fibers at both. Numbers are
+	microseconds per actor, so lower is better.
+*/
+
+#include "CDPL.h"
+
+using namespace Concurrent;
+
+constexpr int small_count = 1000;
+constexpr int large_count = 100000;
+constexpr int passes = 10;
+
+struct Actor: public Thread{
+	sem_t& in;
+	sem_t& out;
+	Actor(sem_t& in, sem_t& out): in(in), out(out){}
+	void run() override{
+		sleep_for(std::chrono::milliseconds(10));
+		for(int i = 0; i < passes; i++){
+			in.wait();
+			out.signal();
+		}
+	}
+};
+
+//ring of actors with one token per actor in flight
+template <typename L>
+double measure(int count, L&& launch){
+	std::vector<sem_t> tokens(count);
+	std::vector<std::unique_ptr<Actor>> actors;
+	for(int i = 0; i < count; i++){
+		actors.emplace_back(new Actor(tokens[i], tokens[(i + 1) % count]));
+		tokens[i].signal();
+	}
+	auto start = std::chrono::steady_clock::now();
+	launch(actors);
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+void report(const char* name, double us){
+	printf("%-40s %10.2f us/actor\n", name, us);
+}
+
+int main(){
+	report("Thread per actor (1000)", measure(small_count, [](std::vector<std::unique_ptr<Actor>>& actors){
+		for(auto& actor: actors)
+			actor->start();
+		for(auto& actor: actors)
+			actor->join();
+	}));
+
+	FiberScheduler fibers;
+	//guarded stacks take two memory mappings each, more than the default limit allows for the large count
+	FiberScheduler unguarded_fibers(std::max(1u, std::thread::hardware_concurrency()), 64 * 1024, false);
+	auto on_fibers = [](FiberScheduler& scheduler){
+		return [&scheduler](std::vector<std::unique_ptr<Actor>>& actors){
+			std::vector<Future<void>> done;
+			for(auto& actor: actors)
+				done.push_back(scheduler.launch(*actor));
+			when_all(done.begin(), done.end()).get();
+		};
+	};
+	report("fiber per actor (1000)", measure(small_count, on_fibers(fibers)));
+	report("fiber per actor (100000)", measure(large_count, on_fibers(unguarded_fibers)));
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+	This example is part of Concurrent and Distributed Programming Library for C++
+	Copyright (C) 2019 Aleksa Ilic <aleksa.d.ilic@gmail.com>
+
+	This Source Code Form is subject to the terms of the Mozilla Public
+	License, v. 2.0. If a copy of the MPL was not distributed with this
+	file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+	..............................................................................
+
+	Latency benchmark of the library's locking primitives: uncontended and
+	contended Mutex lock/unlock, Monitor, SharedMonitor and CombiningMonitor calls, Rcu reads, ShardedCounter adds
+	as the lock-free alternative to a counting monitor, and Semaphore
+	and cond ping-pong between two threads, with std::mutex as the baseline. Numbers are nanoseconds per
+	operation, so lower is better.
+*/
+
+#include "CDPL.h"
+
+using namespace Concurrent;
+
+constexpr int iterations = 1000000;
+constexpr int num_of_threads = 4;
+
+class Counter: public Monitorable{
+	long value = 0;
+public:
+	void inc(){ value++; }
+	long get() const { return value; }
+};
+
+class Turn: public Monitorable{
+	int turn = 0;
+	cond changed = cond_gen("changed");
+public:
+	void pass(int self){
+		while(turn != self)
+			changed.wait();
+		turn = 1 - self;
+		changed.signal();
+	}
+};
+
+struct FairMutex: public Mutex{
+	FairMutex(): Mutex(true){}
+};
+
+template <typename F>
+double measure(int threads, F&& fn){
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for(int i = 0; i < threads; i++)
+		workers.emplace_back([&fn]{ for(int j = 0; j < iterations; j++) fn(); });
+	for(auto& worker: workers)
+		worker.join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (static_cast<double>(iterations) * threads);
+}
+
+template <typename M>
+double lock_unlock(int threads){
+	M mutex;
+	long counter = 0;
+	return measure(threads, [&]{ mutex.lock(); counter++; mutex.unlock(); });
+}
+
+double ping_pong(){
+	Semaphore ping, pong;
+	auto start = std::chrono::steady_clock::now();
+	std::thread partner([&]{
+		for(int i = 0; i < iterations / 10; i++){ ping.wait(); pong.signal(); }
+	});
+	for(int i = 0; i < iterations / 10; i++){ ping.signal(); pong.wait(); }
+	partner.join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (iterations / 10);
+}
+
+double cond_ping_pong(){
+	monitor<Turn> turn;
+	auto start = std::chrono::steady_clock::now();
+	std::thread partner([&]{
+		for(int i = 0; i < iterations / 10; i++) turn->pass(1);
+	});
+	for(int i = 0; i < iterations / 10; i++) turn->pass(0);
+	partner.join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (iterations / 10);
+}
+
+void report(const char* name, double ns){
+	printf("%-40s %10.1f ns/op\n", name, ns);
+}
+
+int main(){
+	report("std::mutex uncontended", lock_unlock<std::mutex>(1));
+	report("Mutex uncontended", lock_unlock<Mutex>(1));
+	report("std::mutex contended (4 threads)", lock_unlock<std::mutex>(num_of_threads));
+	report("Mutex contended (4 threads)", lock_unlock<Mutex>(num_of_threads));
+	report("fair Mutex contended (4 threads)", lock_unlock<FairMutex>(num_of_threads));
+
+	monitor<Counter> counter;
+	report("Monitor call uncontended", measure(1, [&]{ counter->inc(); }));
+	report("Monitor call contended (4 threads)", measure(num_of_threads, [&]{ counter->inc(); }));
+	report("Monitor read (4 threads)", measure(num_of_threads, [&]{ counter->get(); }));
+	ShardedCounter sharded_counter;
+	report("ShardedCounter add (4 threads)", measure(num_of_threads, [&]{ ++sharded_counter; }));
+
+	shared_monitor<Counter> shared_counter;
+	report("SharedMonitor read (4 threads)", measure(num_of_threads, [&]{ shared_counter.read()->get(); }));
+	report("SharedMonitor write (4 threads)", measure(num_of_threads, [&]{ shared_counter->inc(); }));
+
+	rcu<Counter> rcu_counter;
+	report("Rcu read (4 threads)", measure(num_of_threads, [&]{ rcu_counter.read()->get(); }));
+
+	combining_monitor<Counter> combining_counter;
+	report("CombiningMonitor apply uncontended", measure(1, [&]{ combining_counter.apply([](Counter& c){ c.inc(); }); }));
+	report("CombiningMonitor apply (4 threads)", measure(num_of_threads, [&]{ combining_counter.apply([](Counter& c){ c.inc(); }); }));
+	report("CombiningMonitor apply ref (4 threads)", measure(num_of_threads, [&]{ combining_counter.apply([](Counter& c) -> Counter& { c.inc(); return c; }); }));
+	report("CombiningMonitor call (4 threads)", measure(num_of_threads, [&]{ combining_counter->inc(); }));
+
+	report("Semaphore ping-pong round trip", ping_pong());
+	report("cond ping-pong round trip", cond_ping_pong());
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+	This example is part of Concurrent and Distributed Programming Library for C++
+	Copyright (C) 2019 Aleksa Ilic <aleksa.d.ilic@gmail.com>
+
+	This Source Code Form is subject to the terms of the Mozilla Public
+	License, v. 2.0. If a copy of the MPL was not distributed with this
+	file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+	..............................................................................
+
+	Cost of running small tasks: one Thread per task versus ThreadPool::submit,
+	tasks spawned from inside the pool (served from worker's own deque and stolen
+	by idle workers), and ThreadPool::parallel_for over a vector. Numbers are
+	nanoseconds per task or per index, so lower is better.
+*/
+
+#include "CDPL.h"
+
+using namespace Concurrent;
+
+constexpr int tasks = 10000;
+constexpr long indices = 10000000;
+
+struct Task: public Thread{
+	std::atomic<int>& done;
+	Task(std::atomic<int>& done): done(done){}
+	void run() override{ done++; }
+};
+
+template <typename F>
+double measure(long ops, F&& fn){
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ops;
+}
+
+void report(const char* name, double ns){
+	printf("%-40s %10.1f ns/op\n", name, ns);
+}
+
+int main(){
+	std::atomic<int> done{0};
+	report("Thread per task", measure(tasks, [&]{
+		std::vector<std::unique_ptr<Task>> threads;
+		for(int i = 0; i < tasks; i++){
+			threads.emplace_back(new Task(done));
+			threads.back()->start();
+		}
+		for(auto& thread: threads)
+			thread->join();
+	}));
+
+	ThreadPool pool;
+	report("ThreadPool::submit", measure(tasks, [&]{
+		std::vector<std::future<void>> results;
+		for(int i = 0; i < tasks; i++)
+			results.push_back(pool.submit([&]{ done++; }));
+		for(auto& result: results)
+			result.get();
+	}));
+	report("ThreadPool::submit from workers", measure(tasks, [&]{
+		std::atomic<int> leaves{0};
+		std::vector<std::future<void>> results;
+		for(int i = 0; i < 100; i++)
+			results.push_back(pool.submit([&]{
+				for(int j = 0; j < tasks / 100; j++)
+					pool.submit([&]{ leaves++; });
+			}));
+		for(auto& result: results)
+			result.get();
+		while(leaves < tasks)
+			std::this_thread::yield();
+	}));
+
+	std::vector<double> values(indices);
+	report("ThreadPool::parallel_for", measure(indices, [&]{
+		pool.parallel_for(0, indices, [&](long i){ values[i] = i * 0.5; });
+	}));
+
+	ThreadPool::stats_t stats = pool.stats();
+	printf("pool: %lld tasks executed, %lld stolen, %lld parks\n", (long long)stats.executed, (long long)stats.stolen, (long long)stats.parked);
+	return 0;
+}
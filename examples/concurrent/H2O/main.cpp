@@ -11,11 +11,12 @@
 	Forming of H2O Mollecule problem: Atoms arrive at barrier at random time. Only
 	when there are 2H atoms and 1O atom can water mollecule be formed.
 
-	Solution given using barrier monitor.
+	Solution given using semaphores that let in two H and one O atom at a time,
+	and a Barrier that holds them until all three are in place and announces the
+	molecule from its completion function.
 */
 
 #include "CDPL.h"
-#include <exception>
 #include <cstdlib>
 
 using namespace Concurrent;
@@ -29,76 +30,33 @@ struct Atom: public Thread{
 
 	Atom(type_t type): type(type), Thread(type == H ? "H" : "O") { }
 };
-class Barrier:public Monitorable{
-	cond enough_hydrogen = cond_gen();
-	cond enough_oxygen = cond_gen();
 
-	cond hydrogen_buffer = cond_gen();
-	cond oxygen_buffer = cond_gen();
-
-	int h_count = 0;
-	int o_count = 0;
-	int form_count = 0;
+class Molecule{
+	sem_t hydrogen_slots {2};
+	sem_t oxygen_slots {1};
+	Barrier forming {3, []{
+		std::cout << lock << std::endl << colorize("Molecule H2O formed!",TC::GREEN) << std::endl << unlock;
+	}};
+	std::atomic<int> form_count {0};
 public:
 	void insert(Atom& atom){
-		if(atom.type == Atom::H){
-			h_count++;
-			if(h_count > 2){
-				hydrogen_buffer.wait();
-				h_count++; //as it will be reset when new element is formed
-			}
-
-			if(h_count==1)
-				enough_hydrogen.wait();
-			else
-				enough_hydrogen.signalAll();
-
-			if(o_count==0)
-				enough_oxygen.wait();
-
-		}else if(atom.type == Atom::O){
-			o_count++;
-			if(o_count > 1){
-				oxygen_buffer.wait();
-				o_count++; //as it will be reset when new element is formed
-			}
-			enough_oxygen.signalAll();
-
-			if(h_count != 2)
-				enough_hydrogen.wait();
-		}else{
-			throw std::exception();
-		}
+		sem_t& slots = atom.type == Atom::H ? hydrogen_slots : oxygen_slots;
+		slots.wait();
 
-		form(atom);
-	}
-	void form(Atom& atom){
 		std::cout << lock;
-
-		if(form_count==0)
+		if(form_count++ % 3 == 0)
 			std::cout << "Molecule is forming: ";
-		std::cout << (atom.type == Atom::H ? 'H' : 'O') <<" ";
-
-		if(++form_count==3){
-			std::cout << std::endl << colorize("Molecule H2O formed!",TC::GREEN) << std::endl;
-			form_count = 0;
-			h_count = 0;
-			o_count = 0;
-
-			//wake 3 needed atoms if possible
-			hydrogen_buffer.signal();
-			hydrogen_buffer.signal();
-			oxygen_buffer.signal();
-		}
+		std::cout << (atom.type == Atom::H ? 'H' : 'O') << " " << std::flush << unlock;
 
-		std::cout << unlock;
+		forming.arrive_and_wait();
+		slots.signal(); //molecule is formed, let the next atom of this type in
 	}
 };
 
-static monitor<Barrier> mon;
+static Molecule molecule;
 void Atom::run(){
 	std::cout << lock << "ATOM " << colorize(type == H ? "H" : "O", TC::YELLOW) << " created\n" << unlock; 
-	mon->insert(*this);
+	molecule.insert(*this);
 }
 
 int main(){
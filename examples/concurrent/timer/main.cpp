@@ -20,7 +20,7 @@ constexpr auto tick_interval = std::chrono::seconds(1);
 
 class Alarm:public Monitorable{
 	uint current_ticks = 0;
-	cond wakeup = cond_gen("wakeup");
+	cond wakeup = cond_gen("wakeup", STABLE); //workers due on the same tick wake up in arrival order
 
 	void onTick(){
 		current_ticks++;
@@ -31,12 +31,9 @@ class Alarm:public Monitorable{
 		if(!wakeup.empty() && wakeup.minrank() <= current_ticks)
 			wakeup.signal();
 	}
-	struct Ticker: public Thread{ 
-		void run();
-	};
-	Ticker* ticker = nullptr;
+	TimerService::timer ticker;
 public:
-	~Alarm(){delete ticker;}
+	~Alarm(){ticker.cancel();}
 
 	void wake_in(uint ticks_from_now){
 		wakeup.wait(current_ticks + ticks_from_now);
@@ -44,21 +41,14 @@ public:
 			wakeup.signal();
 	}
 
-	void start(){
-		if(ticker == nullptr){
-			ticker = new Ticker();
-			ticker->start();
-		}
-	}
+	void start();
 };
 
 static monitor<Alarm> alarm;
 
-void Alarm::Ticker::run(){
-	while(true){
-		sleep_for(tick_interval);
-		alarm->onTick();
-	}
+void Alarm::start(){
+	if(!ticker.pending())
+		ticker = TimerService::global().schedule_every(tick_interval, []{ alarm->onTick(); });
 }
 struct Worker:public Thread{
 	static std::atomic<uint> next_id;
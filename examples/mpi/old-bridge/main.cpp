@@ -15,13 +15,13 @@
 
     Solution similar to one-lane-bridge example given in concurrent folder, just
     needs to utilize MPI as means of communication and no optimization for direction
-    flip on max car pass.
+    flip on max car pass. Cars call the bridge over RpcChannel and the bridge defers
+    its reply until the car may pass.
 */
 
 #include "CDPL.h"
 #include <cstdlib>
 
-#define N_CARS 20
 #define MAX_MASS 201
 
 using namespace Concurrent;
@@ -30,8 +30,8 @@ using namespace Testbed;
 using namespace Utils;
 
 enum dir_t {NORTH,SOUTH};
-enum op_t  {WAIT,PASS,ENTER,EXIT};
-enum err_t {ERR_INVALID_OP,ERR_CAR_OVERFLOW};
+enum op_t  {PASS,ENTER,EXIT};
+enum err_t {ERR_INVALID_OP};
 
 struct msg_t{
     uint  id;
@@ -39,59 +39,55 @@ struct msg_t{
     dir_t dir;
     uint  mass;
 };
-typedef MonitorMessageBox<msg_t> MailBox;
+typedef RpcChannel<msg_t, op_t> BridgeChannel;
 
 class Car: public Thread{
-    MailBox& bridge_mbx;
+    BridgeChannel& bridge;
     std::string name;
     dir_t direction;
     uint  id;
     uint  mass;
 public:
-    static MailBox mbx[N_CARS];
     static std::atomic<uint> next_id;
-    Car(MailBox& bridge_mbx, dir_t direction, uint mass): bridge_mbx(bridge_mbx), id(next_id++), direction(direction), mass(mass){
-        if(id == N_CARS) throw ERR_CAR_OVERFLOW;
+    Car(BridgeChannel& bridge, dir_t direction, uint mass): bridge(bridge), id(next_id++), direction(direction), mass(mass){
         name = string_format("CAR[%c#%d]", direction == SOUTH ? 'S' : 'N', id);
         Thread::set_name(name.data());
         std::cout << lock << name << colorize(" created", TC::YELLOW) << std::endl << unlock;
     }
-    Car(MailBox& bridge_mbx, dir_t direction): Car(bridge_mbx, direction, rand() % 70 + 30) { }
+    Car(BridgeChannel& bridge, dir_t direction): Car(bridge, direction, rand() % 70 + 30) { }
     void run() override{
-        bridge_mbx->put(msg_t{id,ENTER,direction,mass});
-        msg_t msg{0,WAIT};
-        while(msg.op == WAIT)
-            msg = mbx[id]->get();
+        bridge.call(msg_t{id,ENTER,direction,mass}).wait(); //bridge replies only once car may pass
 
         std::cout << lock << name << " is " << colorize("passing",TC::RED, TS::BOLD) << std::endl << unlock;
         sleep_for(std::chrono::seconds(rand() % 4 + 3));
 
-        bridge_mbx->put(msg_t{id,EXIT,direction,mass});
+        bridge.call(msg_t{id,EXIT,direction,mass}).wait();
         std::cout << lock << name << colorize(" exiting", TC::GREEN) << std::endl << unlock;
     }
 };
-MailBox Car::mbx[N_CARS];
 std::atomic<uint> Car::next_id {0};
 
 class OldBridge: public Thread{
-    MailBox& mbx;
+    BridgeChannel& channel;
     dir_t current_dir = SOUTH;
     uint current_mass = 0;
-    std::list<msg_t> wait_list;
+    std::list<BridgeChannel::Request> wait_list;
 public:
-    OldBridge(MailBox&mbx): Thread("OldBridge"), mbx(mbx){}
+    OldBridge(BridgeChannel& channel): Thread("OldBridge"), channel(channel){}
     void run() override{
         while(true){
-            msg_t msg = mbx->get();
+            BridgeChannel::Request request = channel.receive();
+            const msg_t& msg = request.payload;
             switch(msg.op){
                 case EXIT:
                     current_mass -= msg.mass;
+                    channel.reply(request.id, EXIT);
                     if(current_mass == 0 && wait_list.size() != 0) //all cars passed and other cars are waiting in oposite direction
                         current_dir = current_dir==NORTH ? SOUTH : NORTH;
                     for(auto i = wait_list.begin(); i!= wait_list.end();){
-                        if(i->dir == current_dir && current_mass+i->mass < MAX_MASS){
-                            Car::mbx[i->id]->put(msg_t{0,PASS,(dir_t)0,0}); //let him pass
-                            current_mass+=i->mass;
+                        if(i->payload.dir == current_dir && current_mass+i->payload.mass < MAX_MASS){
+                            channel.reply(i->id, PASS); //let him pass
+                            current_mass+=i->payload.mass;
                             i = wait_list.erase(i);
                         }else
                             i++;
@@ -100,14 +96,13 @@ public:
                 case ENTER:
                     if( msg.dir == current_dir && current_mass+msg.mass < MAX_MASS){
                         current_mass += msg.mass;
-                        Car::mbx[msg.id]->put(msg_t{0,PASS,(dir_t)0,0});
+                        channel.reply(request.id, PASS);
                     }else if( msg.dir != current_dir && current_mass==0){
                         current_dir = msg.dir;
                         current_mass += msg.mass;
-                        Car::mbx[msg.id]->put(msg_t{0,PASS,(dir_t)0,0});
+                        channel.reply(request.id, PASS);
                     }else{
-                        Car::mbx[msg.id]->put(msg_t{0,WAIT,(dir_t)0,0});
-                        wait_list.push_back(msg);
+                        wait_list.push_back(request); //reply is deferred until car may pass
                     }
                     break;
                 default:
@@ -120,15 +115,15 @@ public:
     }
 };
 
-static MailBox bridge_mbx {10, "oldbridge"};
+static BridgeChannel bridge_channel {10, "oldbridge"};
 
 int main(){
     srand(539235);
 
-    OldBridge olb(bridge_mbx);
+    OldBridge olb(bridge_channel);
     olb.start();
 
-	std::vector<ThreadGenerator<Car>> generators = { {1s, 5s, bridge_mbx, NORTH}, {1s, 5s, bridge_mbx, SOUTH} };
+	std::vector<ThreadGenerator<Car>> generators = { {1s, 5s, bridge_channel, NORTH}, {1s, 5s, bridge_channel, SOUTH} };
 	for(auto& generator: generators)
 		generator.start();
 